@@ -0,0 +1,7420 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h> // printf, fork()
+#include <unistd.h> // write
+#include <string.h> // string
+#include <linux/limits.h> // PATH_MAX
+#include <sys/types.h> // pid_t
+#include <sys/wait.h> // wait(), waitpid()
+#include <fcntl.h> // open, O_CREAT, O_TRUNC, O_RDONLY
+#include <time.h> // nanosleep
+#include <signal.h> // sigaction, SIGINT, SIGTSTP
+#include <errno.h> // errno
+#include <ctype.h> // isalpha, isalnum
+#include <sys/mman.h> // memfd_create
+#include <sys/stat.h> // fstatat
+#include <sys/syscall.h> // SYS_getdents64
+#include <dirent.h> // DT_DIR, DT_LNK, DT_UNKNOWN
+#include <sys/socket.h> // socket, sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/un.h> // sockaddr_un
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/resource.h> // wait4, struct rusage
+#include <sys/sendfile.h> // sendfile
+#include <sys/timerfd.h> // timerfd_create, timerfd_settime
+#include <poll.h> // poll
+#include <termios.h> // tcgetpgrp, tcsetpgrp
+#include <sched.h> // sched_setaffinity, cpu_set_t
+#include <linux/mempolicy.h> // MPOL_BIND
+#include <linux/ioprio.h> // IOPRIO_PRIO_VALUE, IOPRIO_CLASS_*
+
+#include "libsmallsh.h"
+
+
+/*
+* Where and how a child is launched, set by the place builtin. nodes is a
+* bitmask of NUMA node numbers, the has* fields mark what was asked for.
+*/
+struct placement {
+    cpu_set_t cpus;
+    int hasCpus;
+    unsigned long nodes;
+    int hasNodes;
+    int niceIncrement;
+    int hasNice;
+    int ioPriority;
+    int hasIoPriority;
+};
+
+
+/*
+* Growable buffer holding the output captured for command substitution.
+*/
+struct captureBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+};
+
+
+/*
+* Output of a command with several "> file" redirections. The command writes
+* into a pipe, the shell copies the pipe to every file with tee() and 
+* splice(). Each file but the last has a scratch pipe the data is teed into.
+*/
+#define FAN_OUT_MAX 16
+struct fanOut {
+    int amount;
+    int pipeFDs[2];
+    int outFDs[FAN_OUT_MAX];
+    int teeFDs[FAN_OUT_MAX][2];
+};
+
+
+/*
+* Functions used before the point where they are defined.
+*/
+struct input* ioRedirection(struct shellState* state, struct input* userInput);
+struct bgProcess* createNode(struct bgProcess* bgList, int childPid);
+void exitChild(struct shellState* state, struct input* userInput);
+char* processSubstitution(struct shellState* state, char* token, struct input* userInput);
+char* commandSubstitution(struct shellState* state, char* token);
+int builtinHash(char* name);
+char* searchPath(char* pathVar, char* name);
+struct commandNode* singleCommand(struct commandNode* tree);
+int runInput(struct shellState* state, struct input* userInput);
+void execNodeInChild(struct shellState* state, struct commandNode* tree);
+void execInputInChild(struct shellState* state, struct input* subInput);
+void stopPromptSegments(struct shellState* state);
+int runNode(struct shellState* state, struct commandNode* node);
+int openFanOut(struct input* userInput, struct fanOut* fan);
+void closeFanOut(struct fanOut* fan);
+ssize_t pumpFanOut(struct fanOut* fan);
+void closeRedirections(struct shellState* state, struct input* userInput, int inFD, int outFD);
+pid_t forkBackground(struct shellState* state, char* name);
+
+
+/*
+* A simple hash function respecting character position in string
+*/
+int hash(char* string) {
+
+    // Initialize the strHash to 0.
+    int strHash = 0;
+
+    // Ensure the string is not NULL.
+    if (string != NULL) {
+        
+        /* Iterate the string adding current characters ascii
+        code + index position + 1 to the cumulative hash. */
+        for (int i = 0; i < strlen(string); i++) {
+            strHash += string[i] + i + 1;
+        }
+    }
+
+    // Return the hash int.
+    return strHash;
+}
+
+
+/*
+* Count digits in an integer.
+*/
+int digitCount(int pid) {
+
+    /* Find the number of digits in pid in order to accurately 
+    allocate memory to the new string */
+    int base = 10;
+    int digits = 1;
+    int pidLen;
+
+    while(1) {
+
+        /* Once pid < base record the amount of digits it has
+        and break out of the loop */
+        if (pid < base) {
+            pidLen = digits;
+            break;
+        }
+    
+        // Multiple the base by 10 and iterate the number of digits
+        base *= 10;
+        digits++;
+    }
+    return pidLen;
+}
+
+
+/*
+* Start an empty output buffer writing to fd.
+*/
+void outputInit(struct outputBuffer* output, int fd) {
+
+    output->fd = fd;
+    output->length = 0;
+    output->segmentAmount = 0;
+    return;
+}
+
+
+/*
+* Add length bytes at text to the segments of output, extending the last
+* segment when text follows right after it.
+*/
+void outputSegment(struct outputBuffer* output, const char* text, size_t length) {
+
+    if (length == 0) {
+        return;
+    }
+    if (output->segmentAmount > 0) {
+        struct iovec* last = &output->segments[output->segmentAmount - 1];
+        if ((char*) last->iov_base + last->iov_len == text) {
+            last->iov_len += length;
+            return;
+        }
+    }
+    output->segments[output->segmentAmount].iov_base = (void*) text;
+    output->segments[output->segmentAmount].iov_len = length;
+    output->segmentAmount++;
+    return;
+}
+
+
+/*
+* Add a copy of text to output, writing out what is there first whenever
+* the buffer or the segments run out.
+*/
+void outputText(struct outputBuffer* output, const char* text) {
+
+    size_t length = strlen(text);
+    while (length > 0) {
+        if (output->length == OUTPUT_BUFFER_SIZE || output->segmentAmount == OUTPUT_SEGMENTS) {
+            outputFlush(output);
+        }
+        size_t amount = OUTPUT_BUFFER_SIZE - output->length;
+        amount = (length < amount) ? length : amount;
+        memcpy(output->data + output->length, text, amount);
+        outputSegment(output, output->data + output->length, amount);
+        output->length += amount;
+        text += amount;
+        length -= amount;
+    }
+    return;
+}
+
+
+/*
+* Add text to output without copying it.
+*/
+void outputConstant(struct outputBuffer* output, const char* text) {
+
+    if (output->segmentAmount == OUTPUT_SEGMENTS) {
+        outputFlush(output);
+    }
+    outputSegment(output, text, strlen(text));
+    return;
+}
+
+
+/*
+* Add number in decimal to output. Digits are produced from the end since
+* snprintf() is not async-signal-safe.
+*/
+void outputNumber(struct outputBuffer* output, long number) {
+
+    char digits[24];
+    char* cursor = digits + sizeof(digits) - 1;
+    unsigned long magnitude = (number < 0) ? -(unsigned long) number : (unsigned long) number;
+    *cursor = '\0';
+    do {
+        *--cursor = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (number < 0) {
+        *--cursor = '-';
+    }
+    outputText(output, cursor);
+    return;
+}
+
+
+/*
+* Write everything in output with one writev(), continuing after partial
+* writes, and empty it. errno is left as it was for signal handlers.
+*/
+void outputFlush(struct outputBuffer* output) {
+
+    int savedErrno = errno;
+    int index = 0;
+    while (index < output->segmentAmount) {
+        ssize_t written = writev(output->fd, output->segments + index, output->segmentAmount - index);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        while (index < output->segmentAmount && (size_t) written >= output->segments[index].iov_len) {
+            written -= output->segments[index].iov_len;
+            index++;
+        }
+        if (index < output->segmentAmount) {
+            output->segments[index].iov_base = (char*) output->segments[index].iov_base + written;
+            output->segments[index].iov_len -= written;
+        }
+    }
+    output->length = 0;
+    output->segmentAmount = 0;
+    errno = savedErrno;
+    return;
+}
+
+
+/*
+* Record the status of the last foreground process to end.
+*/ 
+void status (struct shellState* state) {
+
+    // Print the last status message to screen with a line break.
+    struct outputBuffer output;
+    outputInit(&output, state->outFD);
+    outputText(&output, state->lastStatus->exitStatus);
+    outputConstant(&output, "\n");
+    outputFlush(&output);
+    return;
+}
+
+
+/*
+* Current CLOCK_MONOTONIC time in nanoseconds, 0 when metrics are off so
+* a disabled shell skips even the clock read.
+*/
+int64_t smallshClock(struct shellState* state) {
+
+    if (state->statsEnabled == 0) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/*
+* Bucket of a latency in a histogram. Values below 2^HISTOGRAM_SUB_BITS have
+* a bucket each, larger ones keep their top HISTOGRAM_SUB_BITS + 1 bits.
+*/
+int histogramIndex(uint64_t value) {
+
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return (int) value;
+    }
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int) ((value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+
+/*
+* Highest value that falls into bucket index.
+*/
+uint64_t histogramBucketMax(int index) {
+
+    if (index < (1 << HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+    int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t mantissa = (index & ((1 << HISTOGRAM_SUB_BITS) - 1)) | (1 << HISTOGRAM_SUB_BITS);
+    return (mantissa << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+
+/*
+* Value at or below which fraction of the recorded latencies fall.
+*/
+uint64_t histogramPercentile(struct histogram* histogram, double fraction) {
+
+    uint64_t target = (uint64_t) (fraction * histogram->count + 0.5);
+    target = (target == 0) ? 1 : target;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint64_t bucketMax = histogramBucketMax(i);
+            return (bucketMax < histogram->max) ? bucketMax : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+
+/*
+* Return the stats of command name, created on first use. NULL when metrics
+* are off.
+*/
+struct commandStats* commandStats(struct shellState* state, char* name) {
+
+    if (state->statsEnabled == 0 || name == NULL) {
+        return NULL;
+    }
+    unsigned int bucket = (unsigned int) hash(name) % STATS_BUCKETS;
+    for (struct commandStats* stats = state->commandStats[bucket]; stats != NULL; stats = stats->next) {
+        if (strcmp(stats->name, name) == 0) {
+            return stats;
+        }
+    }
+    struct commandStats* stats = calloc(1, sizeof(struct commandStats));
+    stats->name = malloc((strlen(name) + 1) * sizeof(char));
+    strcpy(stats->name, name);
+    stats->next = state->commandStats[bucket];
+    state->commandStats[bucket] = stats;
+    return stats;
+}
+
+
+/*
+* Record the time since started for metric, in the shell's histogram and in
+* the one of command when there is one. A started of 0 was taken while 
+* metrics were off.
+*/
+void recordMetric(struct shellState* state, int metric, struct commandStats* command, int64_t started) {
+
+    if (started == 0 || state->statsEnabled == 0) {
+        return;
+    }
+    int64_t elapsed = smallshClock(state) - started;
+    uint64_t value = (elapsed > 0) ? (uint64_t) elapsed : 0;
+    int index = histogramIndex(value);
+    struct histogram* histogram = &state->metrics[metric];
+    for (int i = 0; i < 2 && histogram != NULL; i++) {
+        histogram->count++;
+        histogram->sum += value;
+        histogram->max = (value > histogram->max) ? value : histogram->max;
+        histogram->buckets[index]++;
+        histogram = (command != NULL && metric < METRIC_PER_COMMAND) ? &command->metrics[metric] : NULL;
+    }
+    return;
+}
+
+
+/*
+* Record the time since started for metric, for callers of the library.
+*/
+void smallshRecord(struct shellState* state, int metric, int64_t started) {
+
+    if (metric >= 0 && metric < METRIC_AMOUNT) {
+        recordMetric(state, metric, NULL, started);
+    }
+    return;
+}
+
+
+/*
+* Free the per command stats and empty every histogram.
+*/
+void resetStats(struct shellState* state) {
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        while (state->commandStats[i] != NULL) {
+            struct commandStats* stats = state->commandStats[i];
+            state->commandStats[i] = stats->next;
+            free(stats->name);
+            free(stats);
+        }
+    }
+    memset(state->metrics, 0, sizeof(state->metrics));
+    return;
+}
+
+
+/*
+* Formats writeStats() can produce.
+*/
+#define STATS_TABLE 0
+#define STATS_JSON 1
+#define STATS_PROMETHEUS 2
+
+
+/*
+* Format a latency in nanoseconds for people, i.e. "850ns", "12.5us", "3.2ms".
+*/
+void formatLatency(uint64_t nanoseconds, char* text, size_t textSize) {
+
+    if (nanoseconds < 1000) {
+        snprintf(text, textSize, "%lluns", (unsigned long long) nanoseconds);
+    } else if (nanoseconds < 1000000) {
+        snprintf(text, textSize, "%.1fus", nanoseconds / 1e3);
+    } else if (nanoseconds < 1000000000) {
+        snprintf(text, textSize, "%.1fms", nanoseconds / 1e6);
+    } else {
+        snprintf(text, textSize, "%.2fs", nanoseconds / 1e9);
+    }
+    return;
+}
+
+
+/*
+* Copy name into text escaped for a JSON string or a Prometheus label value,
+* which both escape backslashes and double quotes. Other control characters
+* are dropped.
+*/
+void escapeName(char* name, char* text, size_t textSize) {
+
+    size_t length = 0;
+    for (; *name != '\0' && length + 3 < textSize; name++) {
+        if (*name == '\\' || *name == '"') {
+            text[length++] = '\\';
+        } else if ((unsigned char) *name < 0x20) {
+            continue;
+        }
+        text[length++] = *name;
+    }
+    text[length] = '\0';
+    return;
+}
+
+
+/*
+* Write one histogram in format. command is NULL for the shell wide ones,
+* first is cleared once a JSON member was written.
+*/
+void writeHistogram(struct outputBuffer* output, int format, char* metricName, char* command, struct histogram* histogram, int* first) {
+
+    if (histogram->count == 0) {
+        return;
+    }
+    uint64_t p50 = histogramPercentile(histogram, 0.5);
+    uint64_t p90 = histogramPercentile(histogram, 0.9);
+    uint64_t p99 = histogramPercentile(histogram, 0.99);
+    char name[256];
+    escapeName((command != NULL) ? command : "", name, sizeof(name));
+    char line[2048];
+    if (format == STATS_TABLE) {
+        char latencies[4][16];
+        formatLatency(p50, latencies[0], sizeof(latencies[0]));
+        formatLatency(p90, latencies[1], sizeof(latencies[1]));
+        formatLatency(p99, latencies[2], sizeof(latencies[2]));
+        formatLatency(histogram->max, latencies[3], sizeof(latencies[3]));
+        snprintf(line, sizeof(line), "%-7s %-16s %8llu %9s %9s %9s %9s\n", metricName, (command != NULL) ? command : "-",
+                 (unsigned long long) histogram->count, latencies[0], latencies[1], latencies[2], latencies[3]);
+    } else if (format == STATS_JSON) {
+        snprintf(line, sizeof(line), "%s\n    {\"metric\": \"%s\", %s%s%s\"count\": %llu, \"sum_ns\": %llu, \"p50_ns\": %llu, "
+                 "\"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}", (*first) ? "" : ",", metricName,
+                 (command != NULL) ? "\"command\": \"" : "", name, (command != NULL) ? "\", " : "",
+                 (unsigned long long) histogram->count, (unsigned long long) histogram->sum, (unsigned long long) p50,
+                 (unsigned long long) p90, (unsigned long long) p99, (unsigned long long) histogram->max);
+    } else {
+        char labels[320];
+        snprintf(labels, sizeof(labels), "metric=\"%s\"%s%s%s", metricName, (command != NULL) ? ",command=\"" : "",
+                 name, (command != NULL) ? "\"" : "");
+        snprintf(line, sizeof(line), "smallsh_latency_seconds{%s,quantile=\"0.5\"} %.9f\n"
+                 "smallsh_latency_seconds{%s,quantile=\"0.9\"} %.9f\nsmallsh_latency_seconds{%s,quantile=\"0.99\"} %.9f\n"
+                 "smallsh_latency_seconds_sum{%s} %.9f\nsmallsh_latency_seconds_count{%s} %llu\n",
+                 labels, p50 / 1e9, labels, p90 / 1e9, labels, p99 / 1e9, labels, histogram->sum / 1e9, labels,
+                 (unsigned long long) histogram->count);
+    }
+    outputText(output, line);
+    *first = 0;
+    return;
+}
+
+
+/*
+* Write the metrics to fd as a table, JSON or Prometheus text.
+*/
+void writeStats(struct shellState* state, int fd, int format) {
+
+    char* metricNames[METRIC_AMOUNT] = { "spawn", "run", "reap", "parse", "input" };
+    struct outputBuffer* output = malloc(sizeof(struct outputBuffer));
+    outputInit(output, fd);
+    if (format == STATS_TABLE) {
+        outputConstant(output, "metric  command             count       p50       p90       p99       max\n");
+    } else if (format == STATS_JSON) {
+        outputConstant(output, "{\"latencies\": [");
+    } else {
+        outputConstant(output, "# HELP smallsh_latency_seconds Latency of smallsh operations.\n");
+        outputConstant(output, "# TYPE smallsh_latency_seconds summary\n");
+    }
+    int first = 1;
+    for (int metric = 0; metric < METRIC_AMOUNT; metric++) {
+        writeHistogram(output, format, metricNames[metric], NULL, &state->metrics[metric], &first);
+    }
+    for (int metric = 0; metric < METRIC_PER_COMMAND; metric++) {
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            for (struct commandStats* stats = state->commandStats[i]; stats != NULL; stats = stats->next) {
+                writeHistogram(output, format, metricNames[metric], stats->name, &stats->metrics[metric], &first);
+            }
+        }
+    }
+    if (format == STATS_JSON) {
+        outputConstant(output, "\n]}\n");
+    }
+    outputFlush(output);
+    free(output);
+    return;
+}
+
+
+/*
+* Write the metrics snapshot asked for with "stats --save FILE", JSON for a
+* name ending in ".json" and Prometheus text otherwise.
+*/
+void saveStats(struct shellState* state) {
+
+    if (state->statsFile[0] == '\0') {
+        return;
+    }
+    int fd = open(state->statsFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+    if (fd == -1) {
+        perror(state->statsFile);
+        return;
+    }
+    size_t length = strlen(state->statsFile);
+    int json = (length >= 5 && strcmp(state->statsFile + length - 5, ".json") == 0);
+    writeStats(state, fd, json ? STATS_JSON : STATS_PROMETHEUS);
+    close(fd);
+    return;
+}
+
+
+/*
+* Return the variable called name, NULL if there is none.
+*/
+struct shellVariable* findVariable(struct shellState* state, char* name) {
+
+    unsigned int bucket = (unsigned int) hash(name) % VARIABLE_BUCKETS;
+    for (struct shellVariable* variable = state->variables[bucket]; variable != NULL; variable = variable->next) {
+        if (strcmp(variable->name, name) == 0) {
+            return variable;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Return the value of the shell variable name, NULL if it is not set. The
+* environment the shell started with was imported into the variables.
+*/
+char* getVariable(struct shellState* state, char* name) {
+
+    struct shellVariable* variable = findVariable(state, name);
+    return (variable != NULL) ? variable->value : NULL;
+}
+
+
+/*
+* Drop every command remembered in the PATH cache.
+*/
+void clearPathCache(struct shellState* state) {
+
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        while (state->pathCache[i] != NULL) {
+            struct pathEntry* entry = state->pathCache[i];
+            state->pathCache[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+    return;
+}
+
+
+/*
+* Note that name changed: the cached envp is stale if it is exported, and
+* commands found through an old PATH may now be found elsewhere.
+*/
+void variableChanged(struct shellState* state, struct shellVariable* variable) {
+
+    if (variable->exported) {
+        state->envpValid = 0;
+    }
+    if (strcmp(variable->name, "PATH") == 0) {
+        clearPathCache(state);
+    }
+    return;
+}
+
+
+/*
+* Set the shell variable name to a copy of value, creating it if needed. An
+* exported variable stays exported.
+*/
+void setVariable(struct shellState* state, char* name, char* value) {
+
+    struct shellVariable* variable = findVariable(state, name);
+
+    // New variables go to the front of their chain.
+    if (variable == NULL) {
+        unsigned int bucket = (unsigned int) hash(name) % VARIABLE_BUCKETS;
+        variable = malloc(sizeof(struct shellVariable));
+        variable->name = malloc((strlen(name) + 1) * sizeof(char));
+        strcpy(variable->name, name);
+        variable->pair = NULL;
+        variable->exported = 0;
+        variable->next = state->variables[bucket];
+        state->variables[bucket] = variable;
+    }
+    free(variable->pair);
+    variable->pair = malloc((strlen(name) + strlen(value) + 2) * sizeof(char));
+    sprintf(variable->pair, "%s=%s", name, value);
+    variable->value = variable->pair + strlen(name) + 1;
+    variableChanged(state, variable);
+    return;
+}
+
+
+/*
+* Mark the variable name as exported to children. Returns -1 if it is not set.
+*/
+int exportVariable(struct shellState* state, char* name) {
+
+    struct shellVariable* variable = findVariable(state, name);
+    if (variable == NULL) {
+        return -1;
+    }
+    if (variable->exported == 0) {
+        variable->exported = 1;
+        state->envpValid = 0;
+    }
+    return 0;
+}
+
+
+/*
+* Remove the variable name, from the environment of children too.
+*/
+void unsetVariable(struct shellState* state, char* name) {
+
+    unsigned int bucket = (unsigned int) hash(name) % VARIABLE_BUCKETS;
+    struct shellVariable** link = &state->variables[bucket];
+    while (*link != NULL) {
+        struct shellVariable* variable = *link;
+        if (strcmp(variable->name, name) == 0) {
+            *link = variable->next;
+            variableChanged(state, variable);
+            free(variable->name);
+            free(variable->pair);
+            free(variable);
+            return;
+        }
+        link = &variable->next;
+    }
+    return;
+}
+
+
+/*
+* Lines loaded by mapfile into the array name, NULL if there is none.
+*/
+struct lineArray* findLineArray(struct shellState* state, char* name) {
+
+    unsigned int bucket = (unsigned int) hash(name) % LINE_ARRAY_BUCKETS;
+    for (struct lineArray* array = state->lineArrays[bucket]; array != NULL; array = array->next) {
+        if (strcmp(array->name, name) == 0) {
+            return array;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Unmap or free the lines of an array and the array itself.
+*/
+void releaseLineArray(struct lineArray* array) {
+
+    if (array->mapped) {
+        munmap(array->data, array->length);
+    } else {
+        free(array->data);
+    }
+    free(array->starts);
+    free(array->name);
+    free(array);
+    return;
+}
+
+
+/*
+* Remove the array name. One a for loop is walking is only marked removed,
+* the loop frees it when it is done. Returns 1 if there was one.
+*/
+int removeLineArray(struct shellState* state, char* name) {
+
+    unsigned int bucket = (unsigned int) hash(name) % LINE_ARRAY_BUCKETS;
+    struct lineArray** link = &state->lineArrays[bucket];
+    while (*link != NULL) {
+        struct lineArray* array = *link;
+        if (strcmp(array->name, name) == 0) {
+            *link = array->next;
+            if (array->running > 0) {
+                array->removed = 1;
+            } else {
+                releaseLineArray(array);
+            }
+            return 1;
+        }
+        link = &array->next;
+    }
+    return 0;
+}
+
+
+/*
+* Start of line index of array, storing it's length without the newline
+* in *length. The line is not NUL terminated.
+*/
+char* lineAt(struct lineArray* array, size_t index, size_t* length) {
+
+    size_t end = array->starts[index + 1] - 1;
+    *length = end - array->starts[index];
+    return array->data + array->starts[index];
+}
+
+
+/*
+* The array a word of exactly the form "${NAME[@]}" stands for, NULL if
+* the word is anything else or NAME holds no lines.
+*/
+struct lineArray* wholeArray(struct shellState* state, char* word) {
+
+    size_t wordLen = strlen(word);
+    if (wordLen < 6 || strncmp(word, "${", 2) != 0 || strcmp(word + wordLen - 4, "[@]}") != 0) {
+        return NULL;
+    }
+    char name[256];
+    size_t nameLen = wordLen - 6;
+    if (nameLen == 0 || nameLen >= sizeof(name)) {
+        return NULL;
+    }
+    strncpy(name, word + 2, nameLen);
+    name[nameLen] = '\0';
+    return findLineArray(state, name);
+}
+
+
+/*
+* Expand "${#NAME[@]}" (how many lines NAME holds) or "${NAME[N]}" (line N,
+* empty past the last one) at the start of word. Stores the text in *value
+* and it's length in *valueLen, the count going into numberBuffer. Returns
+* the characters the reference spans, 0 if word does not start with one.
+*/
+size_t arrayReference(struct shellState* state, char* word, char* numberBuffer, char** value, size_t* valueLen) {
+
+    int counting = (word[2] == '#');
+    char* nameStart = word + 2 + counting;
+    char* nameEnd = nameStart;
+    while (*nameEnd == '_' || isalnum((unsigned char) *nameEnd)) {
+        nameEnd++;
+    }
+    char* close = (*nameEnd == '[') ? strstr(nameEnd, "]}") : NULL;
+    if (nameEnd == nameStart || (size_t) (nameEnd - nameStart) >= 256 || close == NULL) {
+        return 0;
+    }
+    char name[256];
+    strncpy(name, nameStart, nameEnd - nameStart);
+    name[nameEnd - nameStart] = '\0';
+    struct lineArray* array = findLineArray(state, name);
+
+    // The count needs "[@]", a line a plain number.
+    char* index = nameEnd + 1;
+    char* indexEnd;
+    unsigned long long line = strtoull(index, &indexEnd, 10);
+    if (counting && (close != index + 1 || *index != '@')) {
+        return 0;
+    }
+    if (counting == 0 && (indexEnd != close || index == close || *index == '-')) {
+        return 0;
+    }
+
+    *value = "";
+    *valueLen = 0;
+    if (counting) {
+        sprintf(numberBuffer, "%zu", (array != NULL) ? array->lineAmount : 0);
+        *value = numberBuffer;
+        *valueLen = strlen(numberBuffer);
+    } else if (array != NULL && line < array->lineAmount) {
+        *value = lineAt(array, line, valueLen);
+    }
+    return close + 2 - word;
+}
+
+
+/*
+* Return the environment children get: the exported variables' pairs. The
+* array is kept in the state and only rebuilt after an exported variable
+* changed, so launching commands in a row reuses it as it is.
+*/
+char** currentEnvironment(struct shellState* state) {
+
+    if (state->envpValid) {
+        return state->envp;
+    }
+
+    int amount = 0;
+    for (int i = 0; i < VARIABLE_BUCKETS; i++) {
+        for (struct shellVariable* variable = state->variables[i]; variable != NULL; variable = variable->next) {
+            amount += variable->exported;
+        }
+    }
+    free(state->envp);
+    state->envp = malloc((amount + 1) * sizeof(char*));
+    amount = 0;
+    for (int i = 0; i < VARIABLE_BUCKETS; i++) {
+        for (struct shellVariable* variable = state->variables[i]; variable != NULL; variable = variable->next) {
+            if (variable->exported) {
+                state->envp[amount] = variable->pair;
+                amount++;
+            }
+        }
+    }
+    state->envp[amount] = NULL;
+    state->envpValid = 1;
+    return state->envp;
+}
+
+
+/*
+* Is word a "NAME=value" assignment?
+*/
+int isAssignment(char* word) {
+
+    if (word[0] != '_' && !isalpha((unsigned char) word[0])) {
+        return 0;
+    }
+    int i = 1;
+    while (word[i] == '_' || isalnum((unsigned char) word[i])) {
+        i++;
+    }
+    return word[i] == '=';
+}
+
+
+/*
+* Return the environment for the command in userInput: the shell's cached 
+* environment with the command's own assignments layered on top. Only the
+* pointers are copied, and only when there are assignments, the result must
+* then be freed (but not the strings in it).
+*/
+char** commandEnvironment(struct shellState* state, struct input* userInput) {
+
+    char** base = currentEnvironment(state);
+    if (userInput->assignmentAmount == 0 && userInput->clearEnvironment == 0) {
+        return base;
+    }
+
+    int baseAmount = 0;
+    while (userInput->clearEnvironment == 0 && base[baseAmount] != NULL) {
+        baseAmount++;
+    }
+    char** envp = malloc((baseAmount + userInput->assignmentAmount + 1) * sizeof(char*));
+    int amount = 0;
+
+    // Pairs from the shell that no assignment replaces or removes.
+    for (int i = 0; i < baseAmount; i++) {
+        size_t nameLen = strchr(base[i], '=') - base[i];
+        int replaced = 0;
+        for (int j = 0; j < userInput->assignmentAmount && replaced == 0; j++) {
+            char* assignment = userInput->assignments[j];
+            replaced = (strncmp(assignment, base[i], nameLen) == 0 && 
+                       (assignment[nameLen] == '=' || assignment[nameLen] == '\0'));
+        }
+        if (replaced == 0) {
+            envp[amount] = base[i];
+            amount++;
+        }
+    }
+
+    // Then the assignments, the last of several for one name wins.
+    for (int j = 0; j < userInput->assignmentAmount; j++) {
+        char* assignment = userInput->assignments[j];
+        char* equals = strchr(assignment, '=');
+        int later = 0;
+        for (int k = j + 1; k < userInput->assignmentAmount && equals != NULL && later == 0; k++) {
+            later = (strncmp(userInput->assignments[k], assignment, equals - assignment + 1) == 0);
+        }
+        if (equals != NULL && later == 0) {
+            envp[amount] = assignment;
+            amount++;
+        }
+    }
+    envp[amount] = NULL;
+    return envp;
+}
+
+
+/*
+* Add a copy of assignment to the input's assignments.
+*/
+void addAssignment(struct input* userInput, char* assignment) {
+
+    userInput->assignments = realloc(userInput->assignments, (userInput->assignmentAmount + 1) * sizeof(char*));
+    userInput->assignments[userInput->assignmentAmount] = malloc((strlen(assignment) + 1) * sizeof(char));
+    strcpy(userInput->assignments[userInput->assignmentAmount], assignment);
+    userInput->assignmentAmount++;
+    return;
+}
+
+
+/*
+* Import the environment the process was started with as exported variables.
+*/
+void importEnvironment(struct shellState* state) {
+
+    extern char** environ;
+    for (char** entry = environ; *entry != NULL; entry++) {
+        char* equals = strchr(*entry, '=');
+        if (equals == NULL || equals == *entry) {
+            continue;
+        }
+        char* name = malloc((equals - *entry + 1) * sizeof(char));
+        strncpy(name, *entry, equals - *entry);
+        name[equals - *entry] = '\0';
+        setVariable(state, name, equals + 1);
+        exportVariable(state, name);
+        free(name);
+    }
+    return;
+}
+
+
+/*
+* Return a copy of word with, from left to right, "$$" replaced by the parent 
+* pid, "$?" by the exit value of the last command, "$NAME" or "${NAME}" 
+* by the variable's value (nothing if unset), and "$1" to "$9", "$#" and
+* "$@" by the arguments of the function being run. "$(" is left for command
+* substitution.
+*/
+char* expandVariables(struct shellState* state, char* word) {
+
+    // Words without a "$" come back unchanged.
+    if (strchr(word, '$') == NULL) {
+        char* copy = malloc((strlen(word) + 1) * sizeof(char));
+        strcpy(copy, word);
+        return copy;
+    }
+
+    // Build the new string in a buffer that doubles as it fills.
+    size_t capacity = strlen(word) + 16;
+    size_t length = 0;
+    char* expandedBuffer = malloc(capacity * sizeof(char));
+    for (size_t i = 0; word[i] != '\0'; i++) {
+
+        // Text each "$" form is replaced with, and how many characters it spans.
+        char* value = NULL;
+        char numberBuffer[24];
+        char nameBuffer[256];
+        size_t span = 0;
+        size_t valueLen = 0;
+        int sliced = 0;
+        if (word[i] == '$' && word[i+1] == '{' && (span = arrayReference(state, word + i, numberBuffer, &value, &valueLen)) > 0) {
+            sliced = 1;
+        } else if (word[i] == '$' && (word[i+1] == '$' || word[i+1] == '?')) {
+            sprintf(numberBuffer, "%d", word[i+1] == '$' ? state->shellPid : state->lastCode);
+            value = numberBuffer;
+            span = 2;
+        } else if (word[i] == '$' && ((word[i+1] >= '1' && word[i+1] <= '9') || word[i+1] == '#')) {
+            int index = word[i+1] - '1';
+            sprintf(numberBuffer, "%d", state->positionalAmount);
+            value = (word[i+1] == '#') ? numberBuffer : (index < state->positionalAmount ? state->positional[index] : "");
+            span = 2;
+        } else if (word[i] == '$' && (word[i+1] == '@' || word[i+1] == '*')) {
+
+            // All arguments, separated by spaces, in a buffer of their own.
+            size_t joinedLen = 1;
+            for (int a = 0; a < state->positionalAmount; a++) {
+                joinedLen += strlen(state->positional[a]) + 1;
+            }
+            char* joined = calloc(joinedLen, sizeof(char));
+            for (int a = 0; a < state->positionalAmount; a++) {
+                strcat(joined, state->positional[a]);
+                if (a + 1 < state->positionalAmount) {
+                    strcat(joined, " ");
+                }
+            }
+            char* rest = expandVariables(state, word + i + 2);
+            expandedBuffer = realloc(expandedBuffer, length + strlen(joined) + strlen(rest) + 1);
+            memcpy(expandedBuffer + length, joined, strlen(joined));
+            length += strlen(joined);
+            strcpy(expandedBuffer + length, rest);
+            free(joined);
+            free(rest);
+            return expandedBuffer;
+        } else if (word[i] == '$' && (word[i+1] == '_' || isalpha((unsigned char) word[i+1]) || word[i+1] == '{')) {
+            int braced = (word[i+1] == '{');
+            size_t nameStart = i + 1 + braced;
+            size_t nameEnd = nameStart;
+            while (word[nameEnd] == '_' || isalnum((unsigned char) word[nameEnd])) {
+                nameEnd++;
+            }
+
+            // "${" without a closing "}" or a name is kept as typed.
+            if (nameEnd - nameStart < sizeof(nameBuffer) && (braced == 0 || (word[nameEnd] == '}' && nameEnd > nameStart))) {
+                strncpy(nameBuffer, word + nameStart, nameEnd - nameStart);
+                nameBuffer[nameEnd - nameStart] = '\0';
+                value = getVariable(state, nameBuffer);
+                value = (value != NULL) ? value : "";
+                span = nameEnd + braced - i;
+            }
+        }
+
+        if (span == 0) {
+            value = &word[i];
+            span = 1;
+        }
+        if (sliced == 0) {
+            valueLen = (value == &word[i]) ? 1 : strlen(value);
+        }
+        while (length + valueLen + 1 > capacity) {
+            capacity *= 2;
+            expandedBuffer = realloc(expandedBuffer, capacity * sizeof(char));
+        }
+        memcpy(expandedBuffer + length, value, valueLen);
+        length += valueLen;
+        i += span - 1;
+    }
+    expandedBuffer[length] = '\0';
+    return expandedBuffer;
+}
+
+
+/*
+* Allocate an input whose buffer holds the first length characters of text.
+*/
+struct input* createInput(char* text, size_t length) {
+
+    struct input* userInput = malloc(sizeof(struct input));
+    userInput->buffer = calloc(length + 1, sizeof(char));
+    strncpy(userInput->buffer, text, length);
+    userInput->expandedBuffer = NULL;
+    userInput->args = calloc(1, sizeof(char*));
+    userInput->argCapacity = 1;
+    userInput->argAmount = 0;
+    userInput->bgFlag = 0;
+    userInput->procSubAmount = 0;
+    userInput->resolvedPath = NULL;
+    userInput->timeoutMs = -1;
+    userInput->killAfterMs = -1;
+    userInput->placement = NULL;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        userInput->limits[i] = LIMIT_UNSET;
+    }
+    userInput->assignments = NULL;
+    userInput->assignmentAmount = 0;
+    userInput->clearEnvironment = 0;
+    userInput->tailExec = 0;
+    userInput->fanPumpPid = 0;
+    return userInput;
+}
+
+
+/*
+* Append arg to the end of userInput->args, which stays NULL terminated. 
+* The string is taken over by userInput, callers must not free it.
+*/
+void appendArg(struct input* userInput, char* arg) {
+
+    // Double the vector when it can't hold another arg plus the NULL.
+    if (userInput->argAmount + 2 > userInput->argCapacity) {
+        userInput->argCapacity *= 2;
+        if (userInput->argCapacity < userInput->argAmount + 2) {
+            userInput->argCapacity = userInput->argAmount + 2;
+        }
+        userInput->args = realloc(userInput->args, userInput->argCapacity * sizeof(char*));
+    }
+    userInput->args[userInput->argAmount] = arg;
+    userInput->argAmount++;
+    userInput->args[userInput->argAmount] = NULL;
+    return;
+}
+
+
+/*
+* Append a copy of arg to the end of userInput->args.
+*/
+void addArg(struct input* userInput, char* arg) {
+
+    char* copy = calloc(strlen(arg) + 1, sizeof(char));
+    strcpy(copy, arg);
+    appendArg(userInput, copy);
+    return;
+}
+
+
+/*
+* Glob element types. A pattern segment such as "a?[0-9]*" is compiled once
+* into a list of these so matching never re-reads the pattern text.
+*/
+#define GLOB_LITERAL 0
+#define GLOB_ANY 1
+#define GLOB_STAR 2
+#define GLOB_SET 3
+
+// Size of the buffer getdents64() fills per call while scanning a directory.
+#define GLOB_DIRENT_BUFFER 65536
+
+// Buckets smaller than this are finished with insertion sort.
+#define RADIX_SORT_CUTOFF 32
+
+
+/*
+* One compiled element of a glob segment. A set ("[a-z]", "[!abc]") is a
+* 256 bit map of the bytes it accepts.
+*/
+struct globElement {
+    int type;
+    unsigned char literal;
+    unsigned char set[32];
+};
+
+
+/*
+* One "/" separated segment of a glob pattern.
+*/
+struct globSegment {
+    char* text;
+    int isLiteral;
+    int isDoubleStar;
+    int matchDot;
+    struct globElement* elements;
+    int elementAmount;
+};
+
+
+/*
+* Growable list of strings collecting glob matches.
+*/
+struct stringList {
+    char** items;
+    size_t amount;
+    size_t capacity;
+};
+
+
+/*
+* Record layout returned by the getdents64 system call.
+*/
+struct linuxDirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+
+/*
+* Does word contain a glob? A "[" only counts when a "]" closes it, so the
+* test command "[" is passed through untouched.
+*/
+int hasGlob(char* word) {
+
+    for (int i = 0; word[i] != '\0'; i++) {
+        if (word[i] == '*' || word[i] == '?') {
+            return 1;
+        }
+        if (word[i] == '[' && word[i+1] != '\0' && strchr(word + i + 2, ']') != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+* Compile the text of one glob segment into segment->elements.
+*/
+void globCompileSegment(struct globSegment* segment) {
+
+    char* text = segment->text;
+    size_t textLen = strlen(text);
+    segment->elements = calloc(textLen + 1, sizeof(struct globElement));
+    segment->elementAmount = 0;
+    segment->isDoubleStar = (strcmp(text, "**") == 0);
+    segment->matchDot = (text[0] == '.');
+    segment->isLiteral = !hasGlob(text);
+
+    for (size_t i = 0; i < textLen; i++) {
+        struct globElement* element = &segment->elements[segment->elementAmount];
+
+        if (text[i] == '*') {
+
+            // Consecutive stars match the same as a single one.
+            if (segment->elementAmount > 0 && element[-1].type == GLOB_STAR) {
+                continue;
+            }
+            element->type = GLOB_STAR;
+        } else if (text[i] == '?') {
+            element->type = GLOB_ANY;
+        } else if (text[i] == '[' && text[i+1] != '\0' && strchr(text + i + 2, ']') != NULL) {
+
+            // A leading "!" or "^" negates the set, a leading "]" is literal.
+            size_t j = i + 1;
+            int negate = 0;
+            if (text[j] == '!' || text[j] == '^') {
+                negate = 1;
+                j++;
+            }
+            int first = 1;
+            while (text[j] != '\0' && (text[j] != ']' || first)) {
+                unsigned char low = text[j];
+                unsigned char high = low;
+                if (text[j+1] == '-' && text[j+2] != ']' && text[j+2] != '\0') {
+                    high = text[j+2];
+                    j += 2;
+                }
+                for (int c = low; c <= high; c++) {
+                    element->set[c / 8] |= 1 << (c % 8);
+                }
+                first = 0;
+                j++;
+            }
+            if (negate) {
+                for (int c = 0; c < 32; c++) {
+                    element->set[c] = ~element->set[c];
+                }
+            }
+            element->type = GLOB_SET;
+            i = j;
+        } else {
+            element->type = GLOB_LITERAL;
+            element->literal = text[i];
+        }
+        segment->elementAmount++;
+    }
+    return;
+}
+
+
+/*
+* Match name against a compiled segment. Stars are handled by remembering
+* the last one seen and retrying from it, which is linear for one star and
+* never recursive.
+*/
+int globMatch(struct globSegment* segment, char* name) {
+
+    // Hidden entries only match a segment that starts with a dot itself.
+    if (name[0] == '.' && segment->matchDot == 0) {
+        return 0;
+    }
+
+    struct globElement* elements = segment->elements;
+    int amount = segment->elementAmount;
+    int element = 0;
+    int starElement = -1;
+    char* starName = NULL;
+
+    while (*name != '\0') {
+        unsigned char c = *name;
+        if (element < amount && elements[element].type == GLOB_STAR) {
+            starElement = element;
+            starName = name;
+            element++;
+            continue;
+        }
+        if (element < amount && 
+           ((elements[element].type == GLOB_LITERAL && elements[element].literal == c) ||
+            (elements[element].type == GLOB_ANY) ||
+            (elements[element].type == GLOB_SET && (elements[element].set[c / 8] & (1 << (c % 8)))))) {
+            element++;
+            name++;
+            continue;
+        }
+
+        // Mismatch, let the last star swallow one more character.
+        if (starElement != -1) {
+            element = starElement + 1;
+            starName++;
+            name = starName;
+            continue;
+        }
+        return 0;
+    }
+
+    // Only trailing stars may be left over.
+    while (element < amount && elements[element].type == GLOB_STAR) {
+        element++;
+    }
+    return element == amount;
+}
+
+
+/*
+* Return a new string of prefix joined to name by a "/".
+*/
+char* globJoin(char* prefix, char* name) {
+
+    size_t prefixLen = strlen(prefix);
+    char* path = malloc(prefixLen + strlen(name) + 2);
+    strcpy(path, prefix);
+    if (prefixLen > 0 && prefix[prefixLen-1] != '/') {
+        strcat(path, "/");
+    }
+    strcat(path, name);
+    return path;
+}
+
+
+/*
+* Append path to a string list, taking it over.
+*/
+void stringListAppend(struct stringList* list, char* path) {
+
+    if (list->amount == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        list->items = realloc(list->items, list->capacity * sizeof(char*));
+    }
+    list->items[list->amount] = path;
+    list->amount++;
+    return;
+}
+
+
+/*
+* Is the directory entry a directory? d_type answers without a stat() for 
+* nearly every file system; only unknown types, and symlinks when they are 
+* to be followed, fall back to fstatat().
+*/
+int globIsDirectory(int dirFD, struct linuxDirent64* entry, int followLinks) {
+
+    if (entry->d_type == DT_DIR) {
+        return 1;
+    }
+    if (entry->d_type == DT_UNKNOWN || (entry->d_type == DT_LNK && followLinks)) {
+        struct stat info;
+        if (fstatat(dirFD, entry->d_name, &info, 0) == 0 && S_ISDIR(info.st_mode)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+* Match segments[index] onward against the directory open on dirFD, whose
+* path is prefix, adding full matching paths to matches. Directories are read
+* in bulk with getdents64() and entered with openat() so no path is looked up
+* from the root twice.
+*/
+void globWalk(int dirFD, char* prefix, struct globSegment* segments, int index, int amount, int trailingSlash, struct stringList* matches) {
+
+    struct globSegment* segment = &segments[index];
+    int last = (index == amount - 1);
+
+    // A literal segment needs no scan, just check or enter it directly.
+    if (segment->isLiteral) {
+        char* path = globJoin(prefix, segment->text);
+        if (last) {
+            struct stat info;
+            int flags = trailingSlash ? 0 : AT_SYMLINK_NOFOLLOW;
+            if (fstatat(dirFD, segment->text, &info, flags) == 0 && (!trailingSlash || S_ISDIR(info.st_mode))) {
+                stringListAppend(matches, path);
+                return;
+            }
+        } else {
+            int subFD = openat(dirFD, segment->text, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (subFD != -1) {
+                globWalk(subFD, path, segments, index + 1, amount, trailingSlash, matches);
+                close(subFD);
+            }
+        }
+        free(path);
+        return;
+    }
+
+    // "**" in the middle of a pattern may also match no directory at all.
+    if (segment->isDoubleStar && !last) {
+        globWalk(dirFD, prefix, segments, index + 1, amount, trailingSlash, matches);
+    }
+
+    // Scan the directory from the start, other segments may have read it.
+    lseek(dirFD, 0, SEEK_SET);
+    char* dirBuffer = malloc(GLOB_DIRENT_BUFFER);
+    long readLen;
+    while ((readLen = syscall(SYS_getdents64, dirFD, dirBuffer, GLOB_DIRENT_BUFFER)) > 0) {
+        for (long offset = 0; offset < readLen;) {
+            struct linuxDirent64* entry = (struct linuxDirent64*) (dirBuffer + offset);
+            offset += entry->d_reclen;
+            char* name = entry->d_name;
+
+            // Never match the "." and ".." entries.
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            if (segment->isDoubleStar) {
+
+                /* "**" walks every non hidden directory without following 
+                symlinks. As the last segment it matches everything it finds. */
+                if (name[0] == '.') {
+                    continue;
+                }
+                int isDirectory = globIsDirectory(dirFD, entry, 0);
+                char* path = globJoin(prefix, name);
+                if (last && (!trailingSlash || isDirectory)) {
+                    stringListAppend(matches, globJoin(prefix, name));
+                }
+                if (isDirectory) {
+                    int subFD = openat(dirFD, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    if (subFD != -1) {
+                        globWalk(subFD, path, segments, index, amount, trailingSlash, matches);
+                        close(subFD);
+                    }
+                }
+                free(path);
+                continue;
+            }
+
+            if (globMatch(segment, name) == 0) {
+                continue;
+            }
+
+            // The last segment adds the match, others descend into it.
+            if (last) {
+                if (!trailingSlash || globIsDirectory(dirFD, entry, 1)) {
+                    stringListAppend(matches, globJoin(prefix, name));
+                }
+            } else if (globIsDirectory(dirFD, entry, 1)) {
+                int subFD = openat(dirFD, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (subFD != -1) {
+                    char* path = globJoin(prefix, name);
+                    globWalk(subFD, path, segments, index + 1, amount, trailingSlash, matches);
+                    free(path);
+                    close(subFD);
+                }
+            }
+        }
+    }
+    free(dirBuffer);
+    return;
+}
+
+
+/*
+* Sort strings[0..amount) in byte order with a most significant digit radix
+* sort, starting at character depth. scratch must hold amount pointers.
+*/
+void radixSortStrings(char** strings, char** scratch, size_t amount, size_t depth) {
+
+    // Small buckets are cheaper to finish with insertion sort.
+    if (amount < RADIX_SORT_CUTOFF) {
+        for (size_t i = 1; i < amount; i++) {
+            char* current = strings[i];
+            size_t j = i;
+            while (j > 0 && strcmp(strings[j-1] + depth, current + depth) > 0) {
+                strings[j] = strings[j-1];
+                j--;
+            }
+            strings[j] = current;
+        }
+        return;
+    }
+
+    // Count the strings in each bucket of the byte at depth.
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < amount; i++) {
+        counts[(unsigned char) strings[i][depth]]++;
+    }
+
+    // Turn counts into bucket starts and distribute through scratch.
+    size_t starts[256];
+    size_t total = 0;
+    for (int c = 0; c < 256; c++) {
+        starts[c] = total;
+        total += counts[c];
+    }
+    for (size_t i = 0; i < amount; i++) {
+        scratch[starts[(unsigned char) strings[i][depth]]++] = strings[i];
+    }
+    memcpy(strings, scratch, amount * sizeof(char*));
+
+    /* Bucket 0 holds strings that ended at depth and is already sorted,
+    every other bucket is sorted on the next character. */
+    size_t bucketStart = counts[0];
+    for (int c = 1; c < 256; c++) {
+        if (counts[c] > 1) {
+            radixSortStrings(strings + bucketStart, scratch, counts[c], depth + 1);
+        }
+        bucketStart += counts[c];
+    }
+    return;
+}
+
+
+/*
+* Expand the glob pattern, adding every match to userInput->args in sorted
+* order. Returns the amount of matches, 0 leaves the pattern to the caller.
+*/
+size_t globExpand(struct input* userInput, char* pattern) {
+
+    // Split the pattern into compiled segments, ignoring empty ones.
+    char* copy = calloc(strlen(pattern) + 1, sizeof(char));
+    strcpy(copy, pattern);
+    struct globSegment* segments = calloc(strlen(pattern) / 2 + 2, sizeof(struct globSegment));
+    int amount = 0;
+    char* cursor = copy;
+    char* text;
+    while ((text = strtok_r(cursor, "/", &cursor)) != NULL) {
+        segments[amount].text = text;
+        globCompileSegment(&segments[amount]);
+        amount++;
+    }
+    int trailingSlash = (pattern[strlen(pattern)-1] == '/');
+
+    // Walk from the root for absolute patterns, otherwise from the cwd.
+    struct stringList matches = { NULL, 0, 0 };
+    int absolute = (pattern[0] == '/');
+    int startFD = open(absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (startFD != -1 && amount > 0) {
+        globWalk(startFD, absolute ? "/" : "", segments, 0, amount, trailingSlash, &matches);
+    }
+    if (startFD != -1) {
+        close(startFD);
+    }
+
+    // Sort the matches and hand them over to the argument vector.
+    if (matches.amount > 0) {
+        char** scratch = malloc(matches.amount * sizeof(char*));
+        radixSortStrings(matches.items, scratch, matches.amount, 0);
+        free(scratch);
+    }
+    for (size_t i = 0; i < matches.amount; i++) {
+        if (trailingSlash) {
+            char* withSlash = globJoin(matches.items[i], "");
+            free(matches.items[i]);
+            matches.items[i] = withSlash;
+        }
+        appendArg(userInput, matches.items[i]);
+    }
+
+    // Free the compiled pattern.
+    for (int i = 0; i < amount; i++) {
+        free(segments[i].elements);
+    }
+    free(segments);
+    free(copy);
+    free(matches.items);
+    return matches.amount;
+}
+
+
+/*
+* Add a word to userInput->args, replacing it with the files it matches if
+* it is a glob. A glob that matches nothing, or names a redirection target,
+* is kept as typed.
+*/
+void addWord(struct input* userInput, char* word) {
+
+    int isTarget = 0;
+    if (userInput->argAmount > 0) {
+        char* previous = userInput->args[userInput->argAmount - 1];
+        isTarget = (strcmp(previous, ">") == 0 || strcmp(previous, "<") == 0);
+    }
+    if (isTarget || hasGlob(word) == 0 || globExpand(userInput, word) == 0) {
+        addArg(userInput, word);
+    }
+    return;
+}
+
+
+/*
+* Token types produced by nextToken(). Words are everything that is not one
+* of the list operators ";", "&", "&&" and "||". A line feed counts as ";".
+*/
+#define TOKEN_WORD 0
+#define TOKEN_SEMICOLON 1
+#define TOKEN_AMPERSAND 2
+#define TOKEN_AND 3
+#define TOKEN_OR 4
+
+
+/*
+* Command tree node types. A command line is parsed once into a tree of
+* these, and only the leaves that end up running are expanded and forked.
+*/
+#define NODE_COMMAND 0
+#define NODE_LIST 1
+#define NODE_AND 2
+#define NODE_OR 3
+#define NODE_GROUP 4
+#define NODE_IF 5
+#define NODE_WHILE 6
+#define NODE_UNTIL 7
+#define NODE_FOR 8
+#define NODE_FUNCTION 9
+
+
+/*
+* Deepest function calls may be nested, which stops runaway recursion.
+*/
+#define FUNCTION_DEPTH_MAX 256
+
+
+/*
+* Values of shellState's loopControl.
+*/
+#define LOOP_BREAK 1
+#define LOOP_CONTINUE 2
+
+
+/*
+* One node of a parsed command line:
+*   NODE_COMMAND  words of a simple command, as typed
+*   NODE_LIST     children run one after the other (";", "&")
+*   NODE_AND      right runs only if left succeeded ("&&")
+*   NODE_OR       right runs only if left failed ("||")
+*   NODE_GROUP    "{ list; }", left is the list
+*   NODE_IF       children are condition and body pairs for "if" and each
+*                 "elif", followed by the "else" body if there is one
+*   NODE_WHILE    right runs while left succeeds
+*   NODE_UNTIL    right runs until left succeeds
+*   NODE_FOR      right runs once for each of words[1...], after they are
+*                 expanded, with the variable words[0] set to it
+* Loop bodies are parsed once and run again each iteration, literal[i] marks
+* words that need no expansion at all so they are copied as they are.
+*/
+struct commandNode {
+    int type;
+
+    char** words;
+    char* literal;
+    int wordAmount;
+    int background;
+
+    struct commandNode** children;
+    int childAmount;
+
+    struct commandNode* left;
+    struct commandNode* right;
+};
+
+
+/*
+* Tokens of a command line and the parser's position in them.
+*/
+struct parser {
+    char** texts;
+    int* types;
+    int amount;
+    int position;
+    int error;
+};
+
+
+/*
+* Return the next token of the string at *cursor and advance the cursor past
+* it, storing it's TOKEN_ type in *type. Parentheses are kept balanced so
+* "<(sort a b)" and "$(a; b)" come back as a single word. Returns a new
+* string, or NULL at end of line.
+*/
+char* nextToken(char** cursor, int* type) {
+
+    // Skip leading white space, stop if nothing is left.
+    char* start = *cursor;
+    while (*start == ' ' || *start == '\t') {
+        start++;
+    }
+    if (*start == '\0') {
+        *cursor = start;
+        return NULL;
+    }
+
+    // List operators.
+    *type = TOKEN_WORD;
+    int opLen = 0;
+    if (*start == ';' || *start == '\n') {
+        *type = TOKEN_SEMICOLON;
+        opLen = 1;
+    } else if (start[0] == '&' && start[1] == '&') {
+        *type = TOKEN_AND;
+        opLen = 2;
+    } else if (start[0] == '|' && start[1] == '|') {
+        *type = TOKEN_OR;
+        opLen = 2;
+    } else if (start[0] == '&' && (start[1] == '\0' || start[1] == ' ' || start[1] == '\t' || start[1] == ';' || start[1] == '\n')) {
+        *type = TOKEN_AMPERSAND;
+        opLen = 1;
+    }
+    if (opLen > 0) {
+        *cursor = start + opLen;
+        char* token = calloc(opLen + 1, sizeof(char));
+        strncpy(token, start, opLen);
+        return token;
+    }
+
+    // Walk to the first white space or operator that is not inside parentheses.
+    char* end = start;
+    int depth = 0;
+    while (*end != '\0') {
+        if (*end == '(') {
+            depth++;
+        } else if (*end == ')' && depth > 0) {
+            depth--;
+        } else if (depth == 0 && (*end == ' ' || *end == '\t' || *end == ';' || *end == '\n' ||
+                  (end[0] == '&' && end[1] == '&') || (end[0] == '|' && end[1] == '|'))) {
+            break;
+        }
+        end++;
+    }
+    *cursor = end;
+    char* token = calloc(end - start + 1, sizeof(char));
+    strncpy(token, start, end - start);
+    return token;
+}
+
+
+/*
+* Allocate a command tree node of the given type.
+*/
+struct commandNode* createCommandNode(int type) {
+
+    struct commandNode* node = calloc(1, sizeof(struct commandNode));
+    node->type = type;
+    return node;
+}
+
+
+/*
+* Free a command tree.
+*/
+void freeCommandNode(struct commandNode* node) {
+
+    if (node == NULL) {
+        return;
+    }
+    for (int i = 0; i < node->wordAmount; i++) {
+        free(node->words[i]);
+    }
+    free(node->words);
+    free(node->literal);
+    for (int i = 0; i < node->childAmount; i++) {
+        freeCommandNode(node->children[i]);
+    }
+    free(node->children);
+    freeCommandNode(node->left);
+    freeCommandNode(node->right);
+    free(node);
+    return;
+}
+
+
+/*
+* Return a copy of a command tree.
+*/
+struct commandNode* copyCommandNode(struct commandNode* node) {
+
+    if (node == NULL) {
+        return NULL;
+    }
+    struct commandNode* copy = createCommandNode(node->type);
+    copy->background = node->background;
+    copy->wordAmount = node->wordAmount;
+    if (node->wordAmount > 0) {
+        copy->words = malloc(node->wordAmount * sizeof(char*));
+        copy->literal = malloc(node->wordAmount * sizeof(char));
+        memcpy(copy->literal, node->literal, node->wordAmount * sizeof(char));
+        for (int i = 0; i < node->wordAmount; i++) {
+            copy->words[i] = malloc((strlen(node->words[i]) + 1) * sizeof(char));
+            strcpy(copy->words[i], node->words[i]);
+        }
+    }
+    copy->childAmount = node->childAmount;
+    if (node->childAmount > 0) {
+        copy->children = malloc(node->childAmount * sizeof(struct commandNode*));
+        for (int i = 0; i < node->childAmount; i++) {
+            copy->children[i] = copyCommandNode(node->children[i]);
+        }
+    }
+    copy->left = copyCommandNode(node->left);
+    copy->right = copyCommandNode(node->right);
+    return copy;
+}
+
+
+/*
+* Report a syntax error at the parser's current token.
+*/
+void syntaxError(struct parser* parser, char* expected) {
+
+    if (parser->error == 0) {
+        char* near = (parser->position < parser->amount) ? parser->texts[parser->position] : "end of line";
+        char message[256];
+        snprintf(message, sizeof(message), "syntax error near %s%s%s\n", 
+                 near, expected != NULL ? ": expected " : "", expected != NULL ? expected : "");
+        write(STDERR_FILENO, message, strlen(message));
+        parser->error = 1;
+    }
+    return;
+}
+
+
+/*
+* Is the parser's current token the word text?
+*/
+int atWord(struct parser* parser, char* text) {
+
+    return parser->position < parser->amount && parser->types[parser->position] == TOKEN_WORD &&
+           strcmp(parser->texts[parser->position], text) == 0;
+}
+
+
+/*
+* Is the parser's current token a reserved word that ends a nested list?
+*/
+int atTerminator(struct parser* parser) {
+
+    char* terminators[] = { "}", "then", "elif", "else", "fi", "do", "done", NULL };
+    for (int i = 0; terminators[i] != NULL; i++) {
+        if (atWord(parser, terminators[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+* Expect the reserved word text, skipping separators before it.
+*/
+void expectWord(struct parser* parser, char* text) {
+
+    while (parser->position < parser->amount && parser->types[parser->position] == TOKEN_SEMICOLON) {
+        parser->position++;
+    }
+    if (parser->error == 0 && !atWord(parser, text)) {
+        syntaxError(parser, text);
+    }
+    parser->position++;
+    return;
+}
+
+
+/*
+* Move the current word into command's words, noting if it needs expansion.
+*/
+void takeWord(struct parser* parser, struct commandNode* command) {
+
+    char* word = parser->texts[parser->position];
+    command->words = realloc(command->words, (command->wordAmount + 1) * sizeof(char*));
+    command->literal = realloc(command->literal, (command->wordAmount + 1) * sizeof(char));
+    command->words[command->wordAmount] = word;
+    command->literal[command->wordAmount] = (strchr(word, '$') == NULL && hasGlob(word) == 0 &&
+                                             !((word[0] == '<' || word[0] == '>') && word[1] == '('));
+    parser->texts[parser->position] = NULL;
+    command->wordAmount++;
+    parser->position++;
+    return;
+}
+
+
+struct commandNode* parseList(struct parser* parser, int inGroup);
+
+
+/*
+* Parse a nested list that must not be empty.
+*/
+struct commandNode* parseBody(struct parser* parser) {
+
+    struct commandNode* body = parseList(parser, 1);
+    if (body == NULL) {
+        syntaxError(parser, "command");
+    }
+    return body;
+}
+
+
+/*
+* compound := "if" list "then" list ("elif" list "then" list)... ["else" list] "fi"
+*           | ("while" | "until") list "do" list "done"
+*           | "for" name "in" word... (";" | newline) "do" list "done"
+*/
+struct commandNode* parseCompound(struct parser* parser) {
+
+    struct commandNode* node;
+    if (atWord(parser, "if")) {
+        node = createCommandNode(NODE_IF);
+        do {
+            parser->position++;
+            node->children = realloc(node->children, (node->childAmount + 2) * sizeof(struct commandNode*));
+            node->children[node->childAmount] = parseBody(parser);
+            expectWord(parser, "then");
+            node->children[node->childAmount + 1] = parseBody(parser);
+            node->childAmount += 2;
+        } while (parser->error == 0 && atWord(parser, "elif"));
+        if (parser->error == 0 && atWord(parser, "else")) {
+            parser->position++;
+            node->children = realloc(node->children, (node->childAmount + 1) * sizeof(struct commandNode*));
+            node->children[node->childAmount] = parseBody(parser);
+            node->childAmount++;
+        }
+        expectWord(parser, "fi");
+        return node;
+    }
+
+    if (atWord(parser, "while") || atWord(parser, "until")) {
+        node = createCommandNode(atWord(parser, "while") ? NODE_WHILE : NODE_UNTIL);
+        parser->position++;
+        node->left = parseBody(parser);
+    } else {
+        node = createCommandNode(NODE_FOR);
+        parser->position++;
+        if (parser->position < parser->amount && parser->types[parser->position] == TOKEN_WORD) {
+            takeWord(parser, node);
+        } else {
+            syntaxError(parser, "name");
+        }
+        if (parser->error == 0 && !atWord(parser, "in")) {
+            syntaxError(parser, "in");
+        }
+        parser->position++;
+        while (parser->error == 0 && parser->position < parser->amount && parser->types[parser->position] == TOKEN_WORD) {
+            takeWord(parser, node);
+        }
+    }
+    expectWord(parser, "do");
+    node->right = parseBody(parser);
+    expectWord(parser, "done");
+    return node;
+}
+
+
+/*
+* Is the current token a function name followed by "()", either within the
+* word ("name()") or as the next word ("name ()")? Returns 1 or 2, the amount
+* of words the name and parentheses take, 0 if it is not.
+*/
+int atFunctionName(struct parser* parser) {
+
+    if (parser->position >= parser->amount || parser->types[parser->position] != TOKEN_WORD) {
+        return 0;
+    }
+    char* word = parser->texts[parser->position];
+    size_t nameLen = strlen(word);
+    int words = 1;
+    if (nameLen > 2 && strcmp(word + nameLen - 2, "()") == 0) {
+        nameLen -= 2;
+    } else if (parser->position + 1 < parser->amount && parser->types[parser->position + 1] == TOKEN_WORD &&
+               strcmp(parser->texts[parser->position + 1], "()") == 0) {
+        words = 2;
+    } else {
+        return 0;
+    }
+    if (!(isalpha((unsigned char) word[0]) || word[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < nameLen; i++) {
+        if (!(isalnum((unsigned char) word[i]) || word[i] == '_' || word[i] == '-' || word[i] == '.')) {
+            return 0;
+        }
+    }
+    return words;
+}
+
+
+/*
+* command := compound | "{" list "}" | name "()" command | word...
+* A word starting with "#" in command position comments out the rest of the
+* line. Returns NULL for a comment or after a syntax error.
+*/
+struct commandNode* parseCommand(struct parser* parser) {
+
+    /* Function definition, the body is kept parsed for every call. It must
+    be a brace group or a compound command. */
+    int functionWords = atFunctionName(parser);
+    if (functionWords > 0) {
+        struct commandNode* function = createCommandNode(NODE_FUNCTION);
+        char* name = parser->texts[parser->position];
+        if (functionWords == 1) {
+            name[strlen(name) - 2] = '\0';
+        }
+        takeWord(parser, function);
+        parser->position += functionWords - 1;
+        if (atWord(parser, "{") || atWord(parser, "if") || atWord(parser, "while") || atWord(parser, "until") ||
+            atWord(parser, "for")) {
+            function->left = parseCommand(parser);
+        } else {
+            syntaxError(parser, "{");
+        }
+        return function;
+    }
+
+    // Control flow, run in the shell itself.
+    if (atWord(parser, "if") || atWord(parser, "while") || atWord(parser, "until") || atWord(parser, "for")) {
+        return parseCompound(parser);
+    }
+
+    // A reserved word closing something that was never opened.
+    if (atTerminator(parser)) {
+        syntaxError(parser, NULL);
+        return NULL;
+    }
+
+    // Brace group, run in the shell itself.
+    if (atWord(parser, "{")) {
+        parser->position++;
+        struct commandNode* group = createCommandNode(NODE_GROUP);
+        group->left = parseList(parser, 1);
+        if (parser->error == 0 && (group->left == NULL || !atWord(parser, "}"))) {
+            syntaxError(parser, "}");
+        }
+        parser->position++;
+        return group;
+    }
+
+    // Comment, skip everything that is left.
+    if (parser->position < parser->amount && parser->types[parser->position] == TOKEN_WORD && 
+        parser->texts[parser->position][0] == '#') {
+        parser->position = parser->amount;
+        return NULL;
+    }
+
+    // Simple command, every word up to the next operator or a comment.
+    struct commandNode* command = createCommandNode(NODE_COMMAND);
+    while (parser->position < parser->amount && parser->types[parser->position] == TOKEN_WORD) {
+        if (parser->texts[parser->position][0] == '#') {
+            parser->position = parser->amount;
+            break;
+        }
+        takeWord(parser, command);
+    }
+    if (command->wordAmount == 0) {
+        syntaxError(parser, NULL);
+    }
+    return command;
+}
+
+
+/*
+* andOr := command (("&&" | "||") command)...
+*/
+struct commandNode* parseAndOr(struct parser* parser) {
+
+    struct commandNode* left = parseCommand(parser);
+    while (parser->error == 0 && left != NULL && parser->position < parser->amount &&
+          (parser->types[parser->position] == TOKEN_AND || parser->types[parser->position] == TOKEN_OR)) {
+        struct commandNode* node = createCommandNode(parser->types[parser->position] == TOKEN_AND ? NODE_AND : NODE_OR);
+        parser->position++;
+        node->left = left;
+        node->right = parseCommand(parser);
+        if (node->right == NULL) {
+            syntaxError(parser, "command");
+        }
+        left = node;
+    }
+    return left;
+}
+
+
+/*
+* list := andOr ((";" | "&") andOr)...
+* A "&" sends the command just before it to the background. Nested
+* lists end at a "}", "then", "fi", "do", "done"... in command position.
+*/
+struct commandNode* parseList(struct parser* parser, int inGroup) {
+
+    struct commandNode* list = createCommandNode(NODE_LIST);
+    while (parser->error == 0 && parser->position < parser->amount) {
+
+        // Empty commands between separators are skipped.
+        int type = parser->types[parser->position];
+        if (type == TOKEN_SEMICOLON || type == TOKEN_AMPERSAND) {
+            parser->position++;
+            continue;
+        }
+        if (inGroup && atTerminator(parser)) {
+            break;
+        }
+
+        struct commandNode* item = parseAndOr(parser);
+        if (item == NULL) {
+            continue;
+        }
+
+        /* "&" applies to the right most command of the item, a group or 
+        compound command going to the background whole. */
+        if (parser->position < parser->amount && parser->types[parser->position] == TOKEN_AMPERSAND) {
+            struct commandNode* last = item;
+            while (last->type == NODE_AND || last->type == NODE_OR) {
+                last = last->right;
+            }
+            last->background = 1;
+        } else if (parser->position < parser->amount && parser->types[parser->position] != TOKEN_SEMICOLON &&
+                 !(inGroup && atTerminator(parser))) {
+            syntaxError(parser, NULL);
+        }
+
+        list->children = realloc(list->children, (list->childAmount + 1) * sizeof(struct commandNode*));
+        list->children[list->childAmount] = item;
+        list->childAmount++;
+    }
+
+    // An empty list parses to nothing.
+    if (list->childAmount == 0) {
+        freeCommandNode(list);
+        return NULL;
+    }
+    return list;
+}
+
+
+/*
+* Parse a command line into a tree. Sets *tree to NULL for a blank or comment
+* line. Returns -1 after printing a syntax error.
+*/
+int parseCommandLine(char* line, struct commandNode** tree) {
+
+    // Split the whole line into tokens first.
+    struct parser parser = { NULL, NULL, 0, 0, 0 };
+    char* cursor = line;
+    char* token;
+    int type;
+    while ((token = nextToken(&cursor, &type)) != NULL) {
+        parser.texts = realloc(parser.texts, (parser.amount + 1) * sizeof(char*));
+        parser.types = realloc(parser.types, (parser.amount + 1) * sizeof(int));
+        parser.texts[parser.amount] = token;
+        parser.types[parser.amount] = type;
+        parser.amount++;
+    }
+
+    *tree = parseList(&parser, 0);
+    if (parser.error == 0 && parser.position < parser.amount) {
+        syntaxError(&parser, NULL);
+    }
+
+    // Words moved into the tree were set to NULL, free the rest.
+    for (int i = 0; i < parser.amount; i++) {
+        free(parser.texts[i]);
+    }
+    free(parser.texts);
+    free(parser.types);
+    if (parser.error != 0) {
+        freeCommandNode(*tree);
+        *tree = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+* Return the alias or function called name, NULL if there is none.
+*/
+struct shellDefinition* findDefinition(struct shellState* state, char* name, int type) {
+
+    unsigned int bucket = (unsigned int) hash(name) % DEFINITION_BUCKETS;
+    for (struct shellDefinition* definition = state->definitions[bucket]; definition != NULL; definition = definition->next) {
+        if (definition->type == type && strcmp(definition->name, name) == 0) {
+            return definition;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Free an alias or function.
+*/
+void releaseDefinition(struct shellDefinition* definition) {
+
+    free(definition->name);
+    freeCommandNode(definition->body);
+    free(definition);
+    return;
+}
+
+
+/*
+* Remove the alias or function called name. A function that is running is
+* freed once it's last call returns. Returns 0 if there was none.
+*/
+int removeDefinition(struct shellState* state, char* name, int type) {
+
+    unsigned int bucket = (unsigned int) hash(name) % DEFINITION_BUCKETS;
+    struct shellDefinition** link = &state->definitions[bucket];
+    while (*link != NULL && ((*link)->type != type || strcmp((*link)->name, name) != 0)) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return 0;
+    }
+    struct shellDefinition* definition = *link;
+    *link = definition->next;
+    if (definition->running > 0) {
+        definition->removed = 1;
+    } else {
+        releaseDefinition(definition);
+    }
+    return 1;
+}
+
+
+/*
+* Define the alias or function name as body, which is taken over, replacing
+* any earlier definition.
+*/
+void addDefinition(struct shellState* state, char* name, int type, struct commandNode* body) {
+
+    removeDefinition(state, name, type);
+    struct shellDefinition* definition = calloc(1, sizeof(struct shellDefinition));
+    definition->name = malloc((strlen(name) + 1) * sizeof(char));
+    strcpy(definition->name, name);
+    definition->type = type;
+    definition->body = body;
+    unsigned int bucket = (unsigned int) hash(name) % DEFINITION_BUCKETS;
+    definition->next = state->definitions[bucket];
+    state->definitions[bucket] = definition;
+    return;
+}
+
+
+/*
+* Write an alias the way it is defined, "alias ll=ls -l".
+*/
+void writeAlias(struct outputBuffer* output, struct shellDefinition* alias) {
+
+    outputConstant(output, "alias ");
+    outputText(output, alias->name);
+    outputConstant(output, "=");
+    for (int i = 0; i < alias->body->wordAmount; i++) {
+        outputText(output, alias->body->words[i]);
+        outputConstant(output, (i + 1 < alias->body->wordAmount) ? " " : "\n");
+    }
+    return;
+}
+
+
+/*
+* alias builtin. "alias NAME=WORD..." makes NAME stand for the words after
+* the "=", which are parsed once, now. "alias NAME" shows one alias, plain 
+* "alias" all of them. Returns 1 if an alias shown does not exist or the
+* words are not a simple command.
+*/
+int aliasCommand(struct shellState* state, struct input* userInput) {
+
+    struct outputBuffer* output = malloc(sizeof(struct outputBuffer));
+    outputInit(output, state->outFD);
+    int result = 0;
+
+    // List every alias.
+    if (userInput->argAmount == 1) {
+        for (int i = 0; i < DEFINITION_BUCKETS; i++) {
+            for (struct shellDefinition* definition = state->definitions[i]; definition != NULL; definition = definition->next) {
+                if (definition->type == DEFINITION_ALIAS) {
+                    writeAlias(output, definition);
+                }
+            }
+        }
+    } else if (strchr(userInput->args[1], '=') == NULL) {
+        struct shellDefinition* alias = findDefinition(state, userInput->args[1], DEFINITION_ALIAS);
+        if (alias != NULL) {
+            writeAlias(output, alias);
+        } else {
+            char message[PATH_MAX + 32];
+            snprintf(message, sizeof(message), "alias: %s: not found\n", userInput->args[1]);
+            write(STDERR_FILENO, message, strlen(message));
+            result = 1;
+        }
+    } else {
+
+        // Join the words back into one line and parse it as a simple command.
+        char* equals = strchr(userInput->args[1], '=');
+        size_t lineLen = strlen(equals + 1) + 1;
+        for (int i = 2; i < userInput->argAmount; i++) {
+            lineLen += strlen(userInput->args[i]) + 1;
+        }
+        char* line = calloc(lineLen, sizeof(char));
+        strcpy(line, equals + 1);
+        for (int i = 2; i < userInput->argAmount; i++) {
+            strcat(line, " ");
+            strcat(line, userInput->args[i]);
+        }
+        *equals = '\0';
+        struct commandNode* tree;
+        struct commandNode* command = NULL;
+        if (parseCommandLine(line, &tree) == 0) {
+            command = singleCommand(tree);
+        }
+        if (command != NULL) {
+            tree->childAmount = 0;
+            addDefinition(state, userInput->args[1], DEFINITION_ALIAS, command);
+        } else {
+            char message[PATH_MAX + 64];
+            snprintf(message, sizeof(message), "alias: %s: must stand for a simple command\n", userInput->args[1]);
+            write(STDERR_FILENO, message, strlen(message));
+            result = 1;
+        }
+        freeCommandNode(tree);
+        free(line);
+    }
+    outputFlush(output);
+    free(output);
+    return result;
+}
+
+
+/*
+* If the first word of command that is not an assignment is an alias, 
+* return a new node with the alias's words in it's place. The words are
+* shared with command and the alias, free it with freeAliasNode(). Returns
+* NULL if there is no alias to expand.
+*/
+struct commandNode* expandAlias(struct shellState* state, struct commandNode* command) {
+
+    int first = 0;
+    while (first < command->wordAmount && isAssignment(command->words[first])) {
+        first++;
+    }
+    if (first == command->wordAmount || command->literal[first] == 0) {
+        return NULL;
+    }
+    struct shellDefinition* alias = findDefinition(state, command->words[first], DEFINITION_ALIAS);
+    if (alias == NULL) {
+        return NULL;
+    }
+    struct commandNode* body = alias->body;
+    struct commandNode* expanded = createCommandNode(NODE_COMMAND);
+    expanded->background = command->background;
+    expanded->wordAmount = command->wordAmount - 1 + body->wordAmount;
+    expanded->words = malloc(expanded->wordAmount * sizeof(char*));
+    expanded->literal = malloc(expanded->wordAmount * sizeof(char));
+    memcpy(expanded->words, command->words, first * sizeof(char*));
+    memcpy(expanded->literal, command->literal, first * sizeof(char));
+    memcpy(expanded->words + first, body->words, body->wordAmount * sizeof(char*));
+    memcpy(expanded->literal + first, body->literal, body->wordAmount * sizeof(char));
+    memcpy(expanded->words + first + body->wordAmount, command->words + first + 1, (command->wordAmount - first - 1) * sizeof(char*));
+    memcpy(expanded->literal + first + body->wordAmount, command->literal + first + 1, (command->wordAmount - first - 1) * sizeof(char));
+    return expanded;
+}
+
+
+/*
+* Free a node made by expandAlias(), leaving the words it shares alone.
+*/
+void freeAliasNode(struct commandNode* node) {
+
+    free(node->words);
+    free(node->literal);
+    free(node);
+    return;
+}
+
+
+/*
+* Expand the words of a simple command into a new input's args: process
+* substitution, "$$", command substitution with field splitting, and globs.
+* Called each time the command is about to run, never at parse time.
+*/
+struct input* expandCommand(struct shellState* state, struct commandNode* command) {
+
+    struct input* userInput = createInput("", 0);
+    int assigning = (command->type == NODE_COMMAND);
+    for (int w = 0; w < command->wordAmount; w++) {
+        char* token = command->words[w];
+
+        /* "NAME=value" words before the command are assignments, their value
+        is expanded but neither split nor globbed. */
+        assigning = assigning && isAssignment(token);
+        if (assigning) {
+            char* assignment = expandVariables(state, token);
+            if (strstr(assignment, "$(") != NULL) {
+                char* substituted = commandSubstitution(state, assignment);
+                free(assignment);
+                assignment = substituted;
+            }
+            addAssignment(userInput, assignment);
+            free(assignment);
+            continue;
+        }
+
+        /* A "<(cmd)" or ">(cmd)" argument is started right away on a pipe and
+        replaced by the /dev/fd/N path of the parent's end of that pipe. */
+        size_t tokenLen = strlen(token);
+        if (tokenLen > 3 && (token[0] == '<' || token[0] == '>') && token[1] == '(' && token[tokenLen-1] == ')') {
+            char* path = processSubstitution(state, token, userInput);
+            if (path != NULL) {
+                addArg(userInput, path);
+                free(path);
+                continue;
+            }
+        }
+
+        // Words with nothing to expand are copied as they are.
+        if (command->literal[w]) {
+            addArg(userInput, token);
+            continue;
+        }
+
+        // A lone "$@" stands for each argument of the function being run.
+        if (strcmp(token, "$@") == 0) {
+            for (int a = 0; a < state->positionalAmount; a++) {
+                addArg(userInput, state->positional[a]);
+            }
+            continue;
+        }
+
+        // A lone "${NAME[@]}" stands for each line of a mapfile array.
+        struct lineArray* lines = wholeArray(state, token);
+        if (lines != NULL) {
+            for (size_t l = 0; l < lines->lineAmount; l++) {
+                size_t lineLen;
+                char* line = lineAt(lines, l, &lineLen);
+                char* arg = malloc(lineLen + 1);
+                memcpy(arg, line, lineLen);
+                arg[lineLen] = '\0';
+                appendArg(userInput, arg);
+            }
+            continue;
+        }
+
+        // Replace $$, $? and $NAME with their values.
+        char* expanded = expandVariables(state, token);
+
+        /* A token holding "$(cmd)" is replaced by cmd's output, which is then
+        split into fields on white space, each field becoming an argument. */
+        if (strstr(expanded, "$(") != NULL) {
+            char* substituted = commandSubstitution(state, expanded);
+            char* fieldCursor = substituted;
+            char* field;
+            while ((field = strtok_r(fieldCursor, " \t\n", &fieldCursor)) != NULL) {
+                addWord(userInput, field);
+            }
+            free(substituted);
+            free(expanded);
+            continue;
+        }
+
+        // Save the token as the current argument, expanding any glob in it.
+        addWord(userInput, expanded);
+        free(expanded);
+    }
+
+    // A command whose words all expanded to nothing is a blank line.
+    if (userInput->argAmount == 0) {
+        addArg(userInput, "\n");
+    }
+
+    // Run in the background if "&" followed it, unless bgIgnore flag is set.
+    userInput->bgFlag = (command->background == 1 && state->bgIgnore == 0 && state->foregroundOnly == 0) ? 1 : 0;
+    return userInput;
+}
+
+
+/* 
+* Free user input dynamic memory each loop.
+*/
+void freeUserInput (struct input* userInput) {
+
+    // Close the parent's ends of any process substitution pipes.
+    for (int i = 0; i < userInput->procSubAmount; i++) {
+        close(userInput->procSubFds[i]);
+    }
+    userInput->procSubAmount = 0;
+
+    // Free userInput and it's members.
+    if (userInput->buffer != NULL) {
+        free(userInput->buffer);
+        for (int i = 0; i < userInput->argAmount; i++) {
+            free(userInput->args[i]);
+        }
+        free(userInput->args);
+        for (int i = 0; i < userInput->assignmentAmount; i++) {
+            free(userInput->assignments[i]);
+        }
+        free(userInput->assignments);
+        free(userInput->placement);
+        free(userInput);
+    }
+    return;
+}
+
+
+/* 
+* Prior to exit, free all remaining dynamic memory keeping track 
+* of background processes, directories, and statuses.
+*/
+void freeState (struct shellState* state) {
+    
+    // Loop through the background process linked list deallocating each node.
+    struct bgProcess* bgList = state->bgList;
+    while (bgList != NULL) {
+
+        // Save prev node, advance node, deallocate prev node.
+        struct bgProcess* prevNode = bgList;
+        bgList = bgList->next;
+        if (prevNode->pidFD != -1) {
+            close(prevNode->pidFD);
+        }
+        free(prevNode);
+    }
+    
+    // Free the PATH cache.
+    clearPathCache(state);
+
+    // Close the descriptors opened with exec.
+    for (int i = 0; i < USER_FD_AMOUNT; i++) {
+        if (state->userFDs[i] != -1) {
+            close(state->userFDs[i]);
+        }
+    }
+
+    // Free the shell variables.
+    for (int i = 0; i < VARIABLE_BUCKETS; i++) {
+        while (state->variables[i] != NULL) {
+            struct shellVariable* variable = state->variables[i];
+            state->variables[i] = variable->next;
+            free(variable->name);
+            free(variable->pair);
+            free(variable);
+        }
+    }
+    free(state->envp);
+    resetStats(state);
+
+    // Free the aliases and functions.
+    for (int i = 0; i < DEFINITION_BUCKETS; i++) {
+        while (state->definitions[i] != NULL) {
+            struct shellDefinition* definition = state->definitions[i];
+            state->definitions[i] = definition->next;
+            releaseDefinition(definition);
+        }
+    }
+
+    // Unmap the mapfile arrays.
+    for (int i = 0; i < LINE_ARRAY_BUCKETS; i++) {
+        while (state->lineArrays[i] != NULL) {
+            struct lineArray* array = state->lineArrays[i];
+            state->lineArrays[i] = array->next;
+            releaseLineArray(array);
+        }
+    }
+
+    // Free the cached prompt segments.
+    for (int i = 0; i < PROMPT_CACHE; i++) {
+        free(state->promptCache[i].command);
+        free(state->promptCache[i].value);
+        if (state->promptCache[i].fd != -1) {
+            close(state->promptCache[i].fd);
+        }
+    }
+
+    // Free savedPWD, lastStatus and it's member, then the state itself.
+    free(state->savedPWD);
+    free(state->lastStatus->exitStatus);
+    free(state->lastStatus);
+    free(state);
+    return;
+}
+
+
+/*
+* Function for freeing dynamic memory used when a child exit's due to error.
+*/
+void exitChild(struct shellState* state, struct input* userInput) {
+
+    // Free buffer, userInput and it's members.
+    freeUserInput(userInput);
+
+    // Free memory for directories, statuses, and tracked background processes.
+    freeState(state); 
+    
+    // Exit with an error.
+    exit(1);
+}
+
+
+/*
+* Clean up remaining processes and all dynamic memory of a shell state.
+*/
+void smallshDestroy(struct shellState* state) {
+
+    /* Check if there are any non terminated child processes. If so, kill
+    the child processes that are running, and reap them with waitpid. */
+    struct bgProcess* tempList = state->bgList->head;
+    while(tempList != NULL) {
+        if (tempList->runStatus == 1 && tempList->reaped == 0) {
+
+            // Kill and reap pid
+            kill(tempList->pid, 1);
+            int wstatus;
+            waitpid(tempList->pid, &wstatus, 0);
+
+            // Process substitution feeders are reaped without a message.
+            if (tempList->procSub == 1) {
+                tempList = tempList->next;
+                continue;
+            }
+
+            // Report processes that are being killed and reaped on exit.
+            outputConstant(&state->output, "pid ");
+            outputNumber(&state->output, tempList->pid);
+            outputConstant(&state->output, " killed and reaped\n");
+        }
+        tempList = tempList->next;
+    }
+    outputFlush(&state->output);
+    stopPromptSegments(state);
+
+    // Write the metrics snapshot, if one was asked for.
+    saveStats(state);
+
+    // Free memory for directories, statuses, and tracked background processes.
+    freeState(state);
+    return;
+}
+
+
+/* 
+* cd functionality, returns 1 if the directory could not be changed:
+* Supports absolute and relative paths, supports "cd", "cd .",
+* "cd ..", "cd -", "cd ~", "cd /", "cd ../../dir" 
+*/
+int cd(struct shellState* state, struct input* userInput) {
+
+    struct directories* savedPWD = state->savedPWD;
+    int result = 0;
+
+    /* Initialize argument hash, initialize currentPath
+    with the maximum characters a path can have. */
+    int argHash = 0;
+    
+    // Create a hash for the cd arg
+    if (userInput->args[1] != NULL) {
+        argHash = hash(userInput->args[1]);
+    }
+
+    // Direct the cd arg to it's proper hash value.
+    switch (argHash) {
+
+        // No argument = 0. Open home directory.
+        case 0:
+
+            // Record prevPWD, change directory, record new currPWD
+            getcwd(savedPWD->prevPWD, sizeof(savedPWD->prevPWD));
+            chdir(getVariable(state, "HOME") != NULL ? getVariable(state, "HOME") : "/");
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            break;
+        
+        // Hash for "~" = 127. Open home directory. 
+        case 127:
+
+            // Record the prevPWD, change directory, record new currPWD.
+            getcwd(savedPWD->prevPWD, sizeof(savedPWD->prevPWD));
+            chdir(getVariable(state, "HOME") != NULL ? getVariable(state, "HOME") : "/");
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            break;
+
+        // Hash for "." = 47. Open current directory. 
+        case 47:
+
+            // Record currPWD, change directory, record prevPWD.
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            chdir(savedPWD->currPWD);
+            getcwd(savedPWD->prevPWD, sizeof(savedPWD->prevPWD));
+            break;
+        
+        // Hash for ".." = 95. Open one directory up.
+        case 95:
+
+            // Record currPWD, record prevPWD.
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            getcwd(savedPWD->prevPWD, sizeof(savedPWD->prevPWD));
+
+            // Find the last "/" in currPWD to determine one directory up.
+            int strLen = 1;
+            int count = 0;
+            for (int i = 0; i < strlen(savedPWD->currPWD); i++) {
+                if (savedPWD->currPWD[i] == '/') {
+                    count++;
+                }
+                strLen++;
+            }
+
+            // Truncate the currPath string unless it's already the root.
+            if (strLen > 1 && count > 1) {
+
+                /* Loop the string and replace the last '/' with '\0' to
+                signify string end. */
+                for (int i = 0; i < strlen(savedPWD->currPWD); i++) {
+                    if (savedPWD->currPWD[i] == '/') {
+                        count--;
+                    }
+
+                    // Replace '/' with '\0' to signify string end.
+                    if (count == 0) {
+                        savedPWD->currPWD[i] = '\0';
+                        chdir(savedPWD->currPWD);
+                        break;
+                    }
+                }
+            }
+            break;
+            
+        // Hash for "-" = 46. Opens previous directory.
+        case 46:
+
+            // Alert the user prevPWD has not been previously set.
+            if (strlen(savedPWD->prevPWD) == 0) {
+                char* message = "cd: prevPWD not set\n";
+                write(state->outFD, message, strlen(message));
+                fflush(stdout);
+                result = 1;
+                break; 
+            }
+
+            // Record currPWD, change currPWD to prevPWD, change prevPWD to currPWD.
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            chdir(savedPWD->prevPWD);
+            strcpy(savedPWD->prevPWD, savedPWD->currPWD);
+
+            // Set new currPWD.
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+            strcat(savedPWD->currPWD, "\n");
+
+            // Print the new current directory after changing.
+            write(state->outFD, savedPWD->currPWD, strlen(savedPWD->currPWD));
+            fflush(stdout);
+            break;
+        
+        // User provided directory.
+        default:
+
+            // Record previous directory.
+            getcwd(savedPWD->prevPWD, sizeof(savedPWD->prevPWD));
+
+            /* If chdir returns an error, print warning to console 
+            with a reentrant function and flush output buffer to ensure 
+            output reaches console */
+            if (chdir(userInput->args[1]) == -1) {
+                char message[PATH_MAX + 35] = "cd: ";
+                strcat(message, userInput->args[1]);
+                strcat(message, ": No such file or directory\n");
+                write(state->outFD, message, strlen(message));
+                fflush(stdout);
+                result = 1;
+            }
+
+            // Record currPWD.
+            getcwd(savedPWD->currPWD, sizeof(savedPWD->currPWD));
+    }
+    return result;
+}
+
+/*
+* Parse a word of the form "[D]>&S", "[D]<&S" or "[D]>&-", which makes 
+* descriptor D a copy of S or closes it. Sets *target to D (1 for ">&" and 0
+* for "<&" when it is left out) and *source to S, -1 for "-". Returns 0 if 
+* word is not such a redirection.
+*/
+int parseDupRedirection(char* word, int* target, int* source) {
+
+    int hasTarget = isdigit((unsigned char) word[0]) ? 1 : 0;
+    char direction = word[hasTarget];
+    if ((direction != '>' && direction != '<') || word[hasTarget + 1] != '&' || word[hasTarget + 2] == '\0' ||
+        word[hasTarget + 3] != '\0') {
+        return 0;
+    }
+    char sourceChar = word[hasTarget + 2];
+    if (sourceChar != '-' && !isdigit((unsigned char) sourceChar)) {
+        return 0;
+    }
+    *target = hasTarget ? word[0] - '0' : (direction == '>' ? 1 : 0);
+    *source = (sourceChar == '-') ? -1 : sourceChar - '0';
+    return 1;
+}
+
+
+/*
+* Return the descriptor the shell holds for n as seen by commands: the file
+* opened with "exec n>file" for 3-9, n itself for 0-2. Returns -1 if n is not
+* open.
+*/
+int shellFD(struct shellState* state, int n) {
+
+    if (n < 0 || n >= USER_FD_AMOUNT) {
+        return -1;
+    }
+    return (n <= 2) ? n : state->userFDs[n];
+}
+
+
+/*
+* Handle all input/output redirection
+*/
+struct input* ioRedirection(struct shellState* state, struct input* userInput) {
+
+    /* Initialize new stdout and stdin file descriptors to -5. 
+    A value of -5 means they were not set, -1 means there was an 
+    error with open(), and any postive int means open() was successful. */
+    int newStdoutFD = -5;
+    int newStdinFD = -5;
+    int resultNewStdout = -5;
+    int resultNewStdinFD = -5;
+    int numArgs = 0;
+
+    // Keep track of change status for background process redirection.
+    int stdinChanged = 0;
+    int stdoutChanged = 0;
+
+    // Index of the first redirection argument, the command's args end there.
+    int redirectIndex = -1;
+
+    // Loop through args searching for input/output redirection arguments.
+    for (int i = 0; i < userInput->argAmount; i++) {
+
+        // A redirection must be followed by a file name.
+        if ((strcmp(userInput->args[i], ">") == 0 || strcmp(userInput->args[i], "<") == 0) && userInput->args[i+1] == NULL) {
+            char* message = "syntax error: missing file name after redirection\n";
+            write(STDOUT_FILENO, message, strlen(message));
+            fflush(stdout);
+            exitChild(state, userInput);
+        }
+
+        // Reinitialize newStdoutFD and newStdinFD to -5 each loop
+        newStdoutFD = -5;
+        newStdinFD = -5;
+
+        /* ">&3", "2>&1", "<&4" and "3>&-": copy a descriptor of the shell (or
+        of this child for 0-2) or close one, in order with the others. */
+        int dupTarget, dupSource;
+        if (parseDupRedirection(userInput->args[i], &dupTarget, &dupSource)) {
+            int sourceFD = (dupSource == -1) ? -1 : shellFD(state, dupSource);
+            if (dupSource == -1) {
+                close(dupTarget);
+            } else if (sourceFD == -1 || dup2(sourceFD, dupTarget) == -1) {
+                char message[64];
+                snprintf(message, sizeof(message), "%d: bad file descriptor\n", dupSource);
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                exitChild(state, userInput);
+            }
+            stdoutChanged = stdoutChanged || (dupTarget == 1);
+            stdinChanged = stdinChanged || (dupTarget == 0);
+            if (redirectIndex == -1) {
+                redirectIndex = i;
+            }
+            continue;
+        }
+
+        // Compare the argument to ">" or "<" using strcmp. 
+        if (strcmp(userInput->args[i], ">") == 0) {
+            
+            // Set the newStdout variable.
+            strcpy(userInput->newStdout, userInput->args[i+1]);
+
+            /* Call open to create or truncate the new output file allowing the process
+            to write only into the file. Set access permissions on the server to -rw-rw---
+            to allow the file to be written to. */
+            newStdoutFD = open(userInput->newStdout, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+
+            /* If open returns a -1, there was an error while opening the file.
+            Print an error message and set exit status to 1 without exiting shell */
+            if (newStdoutFD == -1) {
+                char* message = malloc((strlen(userInput->newStdout) + 2) * sizeof(char));
+                strcpy(message, userInput->newStdout);
+                strcat(message, ": ");
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                perror("");
+                free(message);
+
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+
+            /* Record the redirection argument to prevent future exec calls 
+            from using it or any args beyond it. Iterate args. */
+            if (redirectIndex == -1) {
+                redirectIndex = i;
+            }
+            i++;
+        } else if (strcmp(userInput->args[i], "<") == 0) {
+
+            // Set the newStdin variable. 
+            strcpy(userInput->newStdin, userInput->args[i+1]);
+
+            /* Call open to read from the given file using read only. A return value
+            of -1 is an error. Any postive int is a success. */
+            newStdinFD = open(userInput->newStdin, O_RDONLY);
+
+            /* If open returns a -1, there was an error while opening the file.
+            Print an error message and set exit status to 1 without exiting shell. */
+            if (newStdinFD == -1) {
+                char* msg1 = "cannot open ";
+                char* msg2 = " for input\n";
+                char* message = malloc((strlen(msg1) + strlen(userInput->newStdin) + strlen(msg2) + 1) * sizeof(char));
+                strcpy(message, msg1);
+                strcat(message, userInput->newStdin);
+                strcat(message, msg2);
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                free(message);
+
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+
+            /* Record the redirection argument to prevent future exec calls 
+            from using it or any args beyond it. Iterate args. */
+            if (redirectIndex == -1) {
+                redirectIndex = i;
+            }
+            i++;
+        }
+
+        /* Was newStdout set? A newStdoutFD of -5 means ">" was not found, and no redirection 
+        of stdout is required. */    
+        if (newStdoutFD != -5) {
+
+            // Use dup2 to redirect the output from stdout to our newStdoutFD file descriptor.
+            resultNewStdout = dup2(newStdoutFD, 1);
+            stdoutChanged = 1; 
+
+            /* Close the opened file to make it available for re-use by the
+            process if necessary */
+            close(newStdoutFD);
+
+            /* If dupe2() returns an error represented by -1, print the error code
+            and set the exit status to -1 but do not exit smallsh. */
+            if (resultNewStdout == -1) {
+                char* message = malloc((strlen(userInput->newStdout) + 12) * sizeof(char));
+                strcpy(message, "dupe2(");
+                strcat(message, userInput->newStdout);
+                strcat(message, ", 1): ");
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                perror("");
+                free(message);
+
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+        }
+
+        /* Was newStdin set? A newStdinFD of -5 means ">" was not found, and no redirection 
+        of stdin is required. */ 
+        if (newStdinFD != -5) {
+
+            // Use dup2 to redirect the output from stdin to our newStdinFD file descriptor.
+            resultNewStdinFD = dup2(newStdinFD, 0);
+            stdinChanged = 1;
+
+            // Close the opened file to make it available for re-use later.
+            close(newStdinFD);
+
+            /* If dupe2() returns an error represented by -1, print the error code
+            and set the exit status to -1 but do not exit smallsh. */
+            if (resultNewStdinFD == -1) {
+                char* message = malloc((strlen(userInput->newStdin) + 12) * sizeof(char));
+                strcpy(message, "dupe2(");
+                strcat(message, userInput->newStdin);
+                strcat(message, ", 0): ");
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                perror("");
+                free(message);
+
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+        }
+    }
+
+    /* If any io redirection happend, free the args from the first redirection
+    onwards so exec only sees the command and it's arguments. */
+    if (redirectIndex != -1) {
+        for (int i = redirectIndex; i < userInput->argAmount; i++) {
+            free(userInput->args[i]);
+        }
+        userInput->args[redirectIndex] = NULL;
+        userInput->argAmount = redirectIndex;
+    }
+    
+    /* Check if i/o redirection has occured for background processes.
+    If not, redirect both to /dev/null */
+    if (userInput->bgFlag == 1) {
+
+        if (stdoutChanged == 0) {
+            int devNullFD = open("/dev/null", O_WRONLY);
+            int result = dup2(devNullFD, 0); 
+
+            /* Close the opened file to make it available for re-use by the
+            process if necessary */
+            close(devNullFD);
+
+            if (newStdoutFD == -1) {
+
+                char* message = malloc((strlen("/dev/null") + 2) * sizeof(char));
+                strcpy(message, "/dev/null");
+                strcat(message, ": ");
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                perror("");
+                free(message);
+                
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+        }
+
+        if (stdinChanged == 0) {
+
+            int devNullFD = open("/dev/null", O_RDONLY);
+            int result = dup2(devNullFD, 0);            
+
+            /* Close the opened file to make it available for re-use by the
+            process if necessary */
+            close(devNullFD);
+
+            /* If dupe2() returns an error represented by -1, print the error code
+            and set the exit status to -1 but do not exit smallsh. */
+            if (result == -1) {
+                char* message = malloc((strlen("/dev/null") + 12) * sizeof(char));
+                strcpy(message, "dupe2(");
+                strcat(message, "/dev/null");
+                strcat(message, ", 0): ");
+                write(STDOUT_FILENO, message, strlen(message));
+                fflush(stdout);
+                perror("");
+                free(message);
+
+                /* Call exit function to clear all dynamic memory in child,
+                set error status to 1 and terminate child. */
+                exitChild(state, userInput);
+            }
+        }
+    }
+    return userInput;
+}
+
+/*
+* Open the "<" and ">" targets of a builtin running in the shell itself,
+* without touching the shell's own stdin and stdout. Parses the arguments the 
+* same way ioRedirection() does, leaving the opened files in *inFD and *outFD
+* (0 and state->outFD when not redirected) and cutting the arguments off at
+* the first redirection. Several ">" targets are fanned out like a child's
+* output, *outFD being a pipe a forked pump copies to each of them. Callers
+* release them with closeRedirections(). Returns -1 after printing an error,
+* with nothing left open.
+*/
+int openRedirections(struct shellState* state, struct input* userInput, int* inFD, int* outFD) {
+
+    *inFD = STDIN_FILENO;
+    *outFD = state->outFD;
+
+    /* The builtin writes from the shell itself, so the shell cannot pump 
+    the pipe the way it does for a child while waiting. A forked copy does. */
+    struct fanOut fan;
+    if (openFanOut(userInput, &fan) == -1) {
+        return -1;
+    }
+    if (fan.amount > 0) {
+        pid_t pumpPid = fork();
+        if (pumpPid == -1) {
+            perror("fork() failed!");
+            closeFanOut(&fan);
+            return -1;
+        }
+        if (pumpPid == 0) {
+            struct sigaction ignoreAction = {0};
+            ignoreAction.sa_handler = SIG_IGN;
+            sigaction(SIGINT, &ignoreAction, NULL);
+            sigaction(SIGTSTP, &ignoreAction, NULL);
+            close(fan.pipeFDs[1]);
+            fan.pipeFDs[1] = -1;
+            while (pumpFanOut(&fan) > 0);
+            exit(0);
+        }
+        *outFD = fan.pipeFDs[1];
+        fan.pipeFDs[1] = -1;
+        closeFanOut(&fan);
+        userInput->fanPumpPid = pumpPid;
+    }
+
+    int redirectIndex = -1;
+    for (int i = 0; i < userInput->argAmount; i++) {
+
+        /* ">&N" and "<&N" point output or input at a copy of one of the 
+        shell's descriptors, owned like an opened file. */
+        int dupTarget, dupSource;
+        if (parseDupRedirection(userInput->args[i], &dupTarget, &dupSource)) {
+            if (redirectIndex == -1) {
+                redirectIndex = i;
+            }
+            int sourceFD = (dupSource == 1) ? state->outFD : shellFD(state, dupSource);
+            int* replaced = (dupTarget == 1) ? outFD : (dupTarget == 0 ? inFD : NULL);
+            if (replaced == NULL || dupSource == -1) {
+                continue;
+            }
+            int fd = (sourceFD == -1) ? -1 : fcntl(sourceFD, F_DUPFD_CLOEXEC, 0);
+            if (fd == -1) {
+                char message[64];
+                snprintf(message, sizeof(message), "%d: bad file descriptor\n", dupSource);
+                write(STDOUT_FILENO, message, strlen(message));
+                closeRedirections(state, userInput, *inFD, *outFD);
+                return -1;
+            }
+            if (*replaced != (dupTarget == 1 ? state->outFD : STDIN_FILENO)) {
+                close(*replaced);
+            }
+            *replaced = fd;
+            continue;
+        }
+
+        int isOutput = (strcmp(userInput->args[i], ">") == 0);
+        if (!isOutput && strcmp(userInput->args[i], "<") != 0) {
+            continue;
+        }
+        if (redirectIndex == -1) {
+            redirectIndex = i;
+        }
+
+        // A redirection must be followed by a file name.
+        char* message = NULL;
+        if (userInput->args[i+1] == NULL) {
+            message = "syntax error: missing file name after redirection\n";
+            write(STDOUT_FILENO, message, strlen(message));
+        } else if (isOutput) {
+
+            // Only one ">" is left here, several were fanned out above.
+            strcpy(userInput->newStdout, userInput->args[i+1]);
+            int fd = open(userInput->newStdout, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+            if (fd == -1) {
+                message = userInput->newStdout;
+                write(STDOUT_FILENO, message, strlen(message));
+                write(STDOUT_FILENO, ": ", 2);
+                perror("");
+            } else {
+                if (*outFD != state->outFD) {
+                    close(*outFD);
+                }
+                *outFD = fd;
+            }
+        } else {
+            strcpy(userInput->newStdin, userInput->args[i+1]);
+            int fd = open(userInput->newStdin, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                char errorMessage[PATH_MAX + 32];
+                message = errorMessage;
+                snprintf(errorMessage, sizeof(errorMessage), "cannot open %s for input\n", userInput->newStdin);
+                write(STDOUT_FILENO, message, strlen(message));
+            } else {
+                if (*inFD != STDIN_FILENO) {
+                    close(*inFD);
+                }
+                *inFD = fd;
+            }
+        }
+        fflush(stdout);
+
+        // Undo what was opened so far.
+        if (message != NULL) {
+            closeRedirections(state, userInput, *inFD, *outFD);
+            return -1;
+        }
+        i++;
+    }
+
+    // Builtins only see the command and it's arguments.
+    if (redirectIndex != -1) {
+        for (int i = redirectIndex; i < userInput->argAmount; i++) {
+            free(userInput->args[i]);
+        }
+        userInput->args[redirectIndex] = NULL;
+        userInput->argAmount = redirectIndex;
+    }
+    return 0;
+}
+
+
+/*
+* Close what openRedirections() opened for a builtin, then wait for the pump
+* of a fan-out so every target is complete once the builtin returns.
+*/
+void closeRedirections(struct shellState* state, struct input* userInput, int inFD, int outFD) {
+
+    if (inFD != STDIN_FILENO) {
+        close(inFD);
+    }
+    if (outFD != state->outFD) {
+        close(outFD);
+    }
+    if (userInput->fanPumpPid > 0) {
+        while (waitpid(userInput->fanPumpPid, NULL, 0) == -1 && errno == EINTR);
+        userInput->fanPumpPid = 0;
+    }
+    return;
+}
+
+
+/*
+* Copy everything readable from inFD to outFD without passing it through a
+* buffer of ours when the kernel can do the copy: copy_file_range() between
+* files, splice() when either side is a pipe, sendfile() from a file to
+* anything else. Each is tried in that order and given up on the first 
+* EINVAL, EXDEV, ENOSYS or similar, ending with read() and write() through a
+* 1MiB buffer. Copies in chunks so "^C" can stop a long copy in between. 
+* Returns -1 on a read or write error.
+*/
+int copyFD(struct shellState* state, int inFD, int outFD) {
+
+    struct stat inStat, outStat;
+    if (fstat(inFD, &inStat) == -1 || fstat(outFD, &outStat) == -1) {
+        return -1;
+    }
+    int inFile = S_ISREG(inStat.st_mode);
+    int eitherPipe = S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode);
+    size_t chunk = 64 * 1024 * 1024;
+
+    // Kernel side copies, moving on to the next one whenever one is refused.
+    int method = (inFile && S_ISREG(outStat.st_mode)) ? 0 : 1;
+    for (; method < 3; method++) {
+        if ((method == 1 && !eitherPipe) || (method == 2 && !inFile)) {
+            continue;
+        }
+        ssize_t copied;
+        int first = 1;
+        do {
+            if (state->interrupted != 0) {
+                return 0;
+            }
+            if (method == 0) {
+                copied = copy_file_range(inFD, NULL, outFD, NULL, chunk, 0);
+            } else if (method == 1) {
+                copied = splice(inFD, NULL, outFD, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            } else {
+                copied = sendfile(outFD, inFD, NULL, chunk);
+            }
+            if (copied == -1 && errno == EINTR) {
+                copied = 1;
+                continue;
+            }
+            if (copied > 0) {
+                first = 0;
+            }
+        } while (copied > 0);
+
+        if (copied == 0) {
+            return 0;
+        }
+
+        // Only give up on a method that failed before moving any data.
+        if (first == 0 || (errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP &&
+            errno != EBADF && errno != ESPIPE)) {
+            return -1;
+        }
+    }
+
+    // Plain copy through a large buffer.
+    size_t bufferSize = 1024 * 1024;
+    char* buffer = malloc(bufferSize);
+    ssize_t readAmount;
+    while ((readAmount = read(inFD, buffer, bufferSize)) != 0 && state->interrupted == 0) {
+        if (readAmount == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(buffer);
+            return -1;
+        }
+        for (ssize_t written = 0; written < readAmount; ) {
+            ssize_t result = write(outFD, buffer + written, readAmount - written);
+            if (result == -1 && errno != EINTR) {
+                free(buffer);
+                return -1;
+            }
+            written += (result > 0) ? result : 0;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+
+/*
+* Close everything a fan-out holds open and forget it.
+*/
+void closeFanOut(struct fanOut* fan) {
+
+    for (int i = 0; i < fan->amount; i++) {
+        if (fan->outFDs[i] != -1) {
+            close(fan->outFDs[i]);
+        }
+        if (fan->teeFDs[i][0] != -1) {
+            close(fan->teeFDs[i][0]);
+            close(fan->teeFDs[i][1]);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (fan->pipeFDs[i] != -1) {
+            close(fan->pipeFDs[i]);
+        }
+    }
+    fan->amount = 0;
+    return;
+}
+
+
+/*
+* Count the "> file" redirections of a command.
+*/
+int outputRedirections(struct input* userInput) {
+
+    int outputs = 0;
+    for (int i = 0; i < userInput->argAmount; i++) {
+        if (strcmp(userInput->args[i], ">") == 0 && userInput->args[i+1] != NULL) {
+            outputs++;
+            i++;
+        }
+    }
+    return outputs;
+}
+
+
+/*
+* Set up a fan-out when a command has more than one "> file" redirection,
+* "cmd > a > b", opening every file and removing those arguments so the
+* child only handles the rest. Leaves fan->amount 0 if there are fewer than
+* two. Returns -1 after printing an error, with nothing left open.
+*/
+int openFanOut(struct input* userInput, struct fanOut* fan) {
+
+    fan->amount = 0;
+    fan->pipeFDs[0] = -1;
+    fan->pipeFDs[1] = -1;
+    int outputs = outputRedirections(userInput);
+    if (outputs < 2) {
+        return 0;
+    }
+    if (outputs > FAN_OUT_MAX) {
+        char* message = "too many output redirections\n";
+        write(STDOUT_FILENO, message, strlen(message));
+        return -1;
+    }
+
+    // Open every target in order, like that many single redirections would.
+    for (int i = 0; i < userInput->argAmount; i++) {
+        if (strcmp(userInput->args[i], ">") != 0 || userInput->args[i+1] == NULL) {
+            continue;
+        }
+        int fd = open(userInput->args[i+1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+        if (fd == -1) {
+            char message[PATH_MAX + 4];
+            snprintf(message, sizeof(message), "%s: ", userInput->args[i+1]);
+            write(STDOUT_FILENO, message, strlen(message));
+            perror("");
+            closeFanOut(fan);
+            return -1;
+        }
+        fan->outFDs[fan->amount] = fd;
+        fan->teeFDs[fan->amount][0] = -1;
+        fan->amount++;
+
+        // Drop the redirection from the arguments.
+        free(userInput->args[i]);
+        free(userInput->args[i+1]);
+        memmove(userInput->args + i, userInput->args + i + 2, (userInput->argAmount - i - 1) * sizeof(char*));
+        userInput->argAmount -= 2;
+        i--;
+    }
+
+    /* The command's pipe, then a scratch pipe per file but the last, each as
+    large as the command's so a tee always fits the whole chunk. */
+    if (pipe2(fan->pipeFDs, O_CLOEXEC) == -1) {
+        perror("pipe2()");
+        closeFanOut(fan);
+        return -1;
+    }
+    int pipeSize = fcntl(fan->pipeFDs[0], F_GETPIPE_SZ);
+    for (int i = 0; i < fan->amount - 1; i++) {
+        if (pipe2(fan->teeFDs[i], O_CLOEXEC) == -1) {
+            perror("pipe2()");
+            closeFanOut(fan);
+            return -1;
+        }
+        if (fcntl(fan->teeFDs[i][0], F_GETPIPE_SZ) < pipeSize) {
+            fcntl(fan->teeFDs[i][0], F_SETPIPE_SZ, pipeSize);
+        }
+    }
+    return 0;
+}
+
+
+/*
+* Move amount bytes from the pipe inFD to outFD with splice(), falling back
+* to read() and write() for files splice() refuses. An outFD of -1, a file 
+* that failed earlier, only has the bytes drained. Returns -1 if writing to
+* outFD failed.
+*/
+int moveFromPipe(int inFD, int outFD, size_t amount) {
+
+    char buffer[64 * 1024];
+    int failed = 0;
+    while (amount > 0) {
+        ssize_t moved = -1;
+        if (outFD != -1) {
+            moved = splice(inFD, NULL, outFD, NULL, amount, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (moved == -1 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (moved == -1 && outFD != -1 && errno != EINVAL) {
+            failed = 1;
+            outFD = -1;
+        }
+        if (moved == -1) {
+            moved = read(inFD, buffer, (amount < sizeof(buffer)) ? amount : sizeof(buffer));
+            if (moved == -1 && errno == EINTR) {
+                continue;
+            }
+            if (moved <= 0) {
+                return -1;
+            }
+            for (ssize_t written = 0; outFD != -1 && written < moved; ) {
+                ssize_t result = write(outFD, buffer + written, moved - written);
+                if (result == -1 && errno != EINTR) {
+                    failed = 1;
+                    outFD = -1;
+                }
+                written += (result > 0) ? result : 0;
+            }
+        }
+        amount -= moved;
+    }
+    return failed ? -1 : 0;
+}
+
+
+/*
+* Copy one chunk of a command's output to every file of fan. The chunk is
+* teed into each scratch pipe and spliced on from there, then spliced from 
+* the command's pipe into the last file, so the data is never copied into
+* user space. Files that fail are dropped, the rest keep receiving. Returns
+* the size of the chunk, 0 once the command closed it's output.
+*/
+ssize_t pumpFanOut(struct fanOut* fan) {
+
+    ssize_t amount = 0;
+    int last = fan->amount - 1;
+    for (int i = 0; i < last; i++) {
+        ssize_t copied;
+        do {
+            copied = tee(fan->pipeFDs[0], fan->teeFDs[i][1], (i == 0) ? 64 * 1024 * 1024 : amount, 0);
+        } while (copied == -1 && errno == EINTR);
+        if (copied <= 0) {
+            return copied;
+        }
+        amount = copied;
+        if (moveFromPipe(fan->teeFDs[i][0], fan->outFDs[i], amount) == -1 && fan->outFDs[i] != -1) {
+            close(fan->outFDs[i]);
+            fan->outFDs[i] = -1;
+        }
+    }
+
+    // The last file consumes the chunk from the command's pipe.
+    if (moveFromPipe(fan->pipeFDs[0], fan->outFDs[last], amount) == -1 && fan->outFDs[last] != -1) {
+        close(fan->outFDs[last]);
+        fan->outFDs[last] = -1;
+    }
+    return amount;
+}
+
+
+/*
+* Does a cat command have options such as "-n"? Those are left to /bin/cat,
+* the builtin only concatenates. A lone "-" is stdin, not an option.
+*/
+int catOptions(struct input* userInput) {
+
+    for (int i = 1; i < userInput->argAmount; i++) {
+        if (userInput->args[i][0] == '-' && userInput->args[i][1] != '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+* cat builtin: concatenate the files named (or stdin for none or "-") into 
+* stdout, in the shell itself. "cat < a > b" and "cat a b > c" cost no fork
+* and, where the kernel allows it, no copy through user space. Returns 1 if 
+* any file could not be copied, like cat.
+*/
+int catFiles(struct shellState* state, struct input* userInput) {
+
+    int inFD, outFD;
+    if (openRedirections(state, userInput, &inFD, &outFD) == -1) {
+        return 1;
+    }
+
+    // No file names reads stdin.
+    int result = 0;
+    int fileAmount = userInput->argAmount - 1;
+    for (int i = 0; i < (fileAmount > 0 ? fileAmount : 1) && state->interrupted == 0; i++) {
+        char* name = (fileAmount > 0) ? userInput->args[i+1] : "-";
+        int fd = (strcmp(name, "-") == 0) ? inFD : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || copyFD(state, fd, outFD) == -1) {
+            char message[PATH_MAX + 8];
+            snprintf(message, sizeof(message), "cat: %s", name);
+            perror(message);
+            result = 1;
+        }
+        if (fd != inFD && fd != -1) {
+            close(fd);
+        }
+    }
+    closeRedirections(state, userInput, inFD, outFD);
+    return result;
+}
+
+
+/*
+* Find the executable a command name runs. Names are looked up in PATH once
+* and remembered in state->pathCache, later lookups cost a single access()
+* to check the file is still there. Names holding a "/" are not looked up.
+* Returns NULL when the name is not found, leaving the search to execvp().
+*/
+char* resolveCommand(struct shellState* state, char* name) {
+
+    if (strchr(name, '/') != NULL || name[0] == '\0') {
+        return NULL;
+    }
+
+    // A cached path is used as long as it is still executable.
+    int bucket = (unsigned int) hash(name) % PATH_CACHE_BUCKETS;
+    struct pathEntry** link = &state->pathCache[bucket];
+    while (*link != NULL) {
+        struct pathEntry* entry = *link;
+        if (strcmp(entry->name, name) == 0) {
+            if (access(entry->path, X_OK) == 0) {
+                return entry->path;
+            }
+
+            // Stale entry, drop it and search PATH again.
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            break;
+        }
+        link = &entry->next;
+    }
+
+    // Walk the PATH directories in order.
+    char* pathVar = getVariable(state, "PATH");
+    char* found = (pathVar != NULL) ? searchPath(pathVar, name) : NULL;
+    if (found == NULL) {
+        return NULL;
+    }
+
+    // Remember the result for next time.
+    struct pathEntry* entry = malloc(sizeof(struct pathEntry));
+    entry->name = calloc(strlen(name) + 1, sizeof(char));
+    strcpy(entry->name, name);
+    entry->path = found;
+    entry->next = state->pathCache[bucket];
+    state->pathCache[bucket] = entry;
+    return found;
+}
+
+
+/*
+* Search the ":" separated directories of pathVar in order for an executable
+* file called name. Returns a new string with it's path, or NULL.
+*/
+char* searchPath(char* pathVar, char* name) {
+
+    char* pathCopy = calloc(strlen(pathVar) + 1, sizeof(char));
+    strcpy(pathCopy, pathVar);
+    char* found = NULL;
+    char* cursor = pathCopy;
+    char* directory;
+    while (found == NULL && (directory = strsep(&cursor, ":")) != NULL) {
+        char* candidate = malloc(strlen(directory) + strlen(name) + 3);
+        sprintf(candidate, "%s/%s", directory[0] == '\0' ? "." : directory, name);
+        struct stat info;
+        if (access(candidate, X_OK) == 0 && stat(candidate, &info) == 0 && S_ISREG(info.st_mode)) {
+            found = candidate;
+        } else {
+            free(candidate);
+        }
+    }
+    free(pathCopy);
+    return found;
+}
+
+
+/*
+* The PATH assigned to this command alone ("PATH=/opt/bin cmd"), NULL if
+* it has none and the shell's is used.
+*/
+char* assignedPath(struct input* userInput) {
+
+    char* pathVar = NULL;
+    for (int i = 0; i < userInput->assignmentAmount; i++) {
+        if (strncmp(userInput->assignments[i], "PATH=", 5) == 0) {
+            pathVar = userInput->assignments[i] + 5;
+        }
+    }
+    return pathVar;
+}
+
+
+/*
+* Exec the input with the shell's environment and any assignments of it's 
+* own. The command is looked up in the shell's PATH (or the one assigned for
+* this command), not the one the process started with. Like execvp(), a file
+* that is not an executable format is run as a /bin/sh script. Only returns,
+* with errno set, if the exec failed.
+*/
+void execCommand(struct shellState* state, struct input* userInput) {
+
+    char** envp = commandEnvironment(state, userInput);
+
+    /* A PATH of the command's own is searched instead of the shell's, which
+    is left as it is. */
+    char* path = userInput->args[0];
+    char* searched = NULL;
+    char* pathVar = assignedPath(userInput);
+    if (strchr(path, '/') == NULL && pathVar != NULL) {
+        path = searched = searchPath(pathVar, path);
+    } else if (strchr(path, '/') == NULL) {
+        path = (userInput->resolvedPath != NULL) ? userInput->resolvedPath : resolveCommand(state, path);
+    }
+    if (path == NULL) {
+        errno = ENOENT;
+        return;
+    }
+    execve(path, userInput->args, envp);
+
+    // No "#!" line, hand the file to the shell.
+    if (errno == ENOEXEC) {
+        char** shellArgs = malloc((userInput->argAmount + 2) * sizeof(char*));
+        shellArgs[0] = "sh";
+        shellArgs[1] = path;
+        for (int i = 1; i <= userInput->argAmount; i++) {
+            shellArgs[i + 1] = userInput->args[i];
+        }
+        execve("/bin/sh", shellArgs, envp);
+        errno = ENOEXEC;
+    }
+    int execError = errno;
+    free(searched);
+    errno = execError;
+    return;
+}
+
+
+/*
+* Record the wait status of a finished foreground child in lastStatus, both
+* as the message shown by "status" and as numbers for library callers.
+*/
+void setStatus(struct shellState* state, int childStatus) {
+
+    struct statusStr* lastStatus = state->lastStatus;
+    free(lastStatus->exitStatus);
+    if (WIFEXITED(childStatus) == 1) {
+
+        // Set new success status accounting for potential 3 digit exit value
+        char* sInt = malloc(4 * sizeof(char));
+        sprintf(sInt, "%d", WEXITSTATUS(childStatus));
+        char* message = "exit value ";
+        lastStatus->exitStatus = malloc((strlen(message) + 5) * sizeof(char));
+        strcpy(lastStatus->exitStatus, message);
+        strcat(lastStatus->exitStatus, sInt);
+        free(sInt);
+        lastStatus->exitValue = WEXITSTATUS(childStatus);
+        lastStatus->termSignal = 0;
+        lastStatus->timedOut = 0;
+    } else {
+        
+        // Set new error status accounting for potential 3 digit exit value  
+        char* sInt = malloc(4 * sizeof(char)); 
+        sprintf(sInt, "%d", WTERMSIG(childStatus)); 
+        char* message = "terminated by signal ";
+        lastStatus->exitStatus = malloc((strlen(message) + 5) * sizeof(char));
+        strcpy(lastStatus->exitStatus, message);
+        strcat(lastStatus->exitStatus, sInt);
+        free(sInt);
+        lastStatus->exitValue = 128 + WTERMSIG(childStatus);
+        lastStatus->termSignal = WTERMSIG(childStatus);
+        lastStatus->timedOut = 0;
+    }
+    return;
+}
+
+
+/*
+* Parse a duration such as "10", "250ms", "2.5s", "1m", "1h" or "1d" into
+* milliseconds. Returns -1 if text is not a duration.
+*/
+long parseDuration(char* text) {
+
+    char* end;
+    errno = 0;
+    double amount = strtod(text, &end);
+    if (end == text || errno != 0 || !(amount >= 0) || amount > 1e12) {
+        return -1;
+    }
+
+    // Seconds unless a unit follows.
+    double unit = 1000;
+    if (*end == 's') {
+        end++;
+    } else if (end[0] == 'm' && end[1] == 's') {
+        unit = 1;
+        end += 2;
+    } else if (*end == 'm') {
+        unit = 60 * 1000;
+        end++;
+    } else if (*end == 'h') {
+        unit = 60 * 60 * 1000;
+        end++;
+    } else if (*end == 'd') {
+        unit = 24 * 60 * 60 * 1000;
+        end++;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    return (long) (amount * unit + 0.5);
+}
+
+
+/*
+* Arm timerFD to expire once, milliseconds from now.
+*/
+void armTimer(int timerFD, long milliseconds) {
+
+    // An all zero it_value would disarm the timer instead.
+    struct itimerspec deadline = {0};
+    deadline.it_value.tv_sec = milliseconds / 1000;
+    deadline.it_value.tv_nsec = (milliseconds % 1000) * 1000000 + 1;
+    timerfd_settime(timerFD, 0, &deadline, NULL);
+    return;
+}
+
+
+/*
+* Wait for the foreground child spawnPid, the leader of it's own process group,
+* for at most timeoutMs. Once the deadline passes the group is sent SIGTERM, 
+* and SIGKILL killAfterMs later if it is still around. The shell sleeps in 
+* poll() on a pidfd of the child and a timerfd, and passes any "^C" it 
+* catches meanwhile on to the group. A timeoutMs of 0 waits without a 
+* deadline. With a fan the command's output is copied to it's files as it 
+* arrives, until the command and anything it left running closed it. 
+* Returns 1 if the child was killed for it's deadline.
+*/
+int waitTimed(struct shellState* state, pid_t spawnPid, long timeoutMs, long killAfterMs, int* childStatus, struct fanOut* fan) {
+
+    int timedOut = 0;
+    int pidFD = syscall(SYS_pidfd_open, spawnPid, 0);
+    int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    // Without pidfds or timerfds the child is simply waited for.
+    if (pidFD != -1 && timerFD != -1) {
+        if (timeoutMs > 0) {
+            armTimer(timerFD, timeoutMs);
+        }
+        struct pollfd pollFDs[3] = { { pidFD, POLLIN, 0 }, { timerFD, POLLIN, 0 }, { -1, POLLIN, 0 } };
+        if (fan != NULL) {
+            pollFDs[2].fd = fan->pipeFDs[0];
+        }
+        while (pollFDs[0].fd != -1 || pollFDs[2].fd != -1) {
+            if (poll(pollFDs, 3, -1) == -1) {
+                if (errno == EINTR && state->interrupted != 0) {
+                    kill(-spawnPid, SIGINT);
+                    state->interrupted = 0;
+                }
+                continue;
+            }
+
+            // The child ended, poll() skips negative fds.
+            if (pollFDs[0].revents != 0) {
+                pollFDs[0].fd = -1;
+            }
+
+            // Output arrived, or every writer closed the pipe.
+            if (pollFDs[2].revents != 0 && pumpFanOut(fan) <= 0) {
+                pollFDs[2].fd = -1;
+            }
+            if (pollFDs[1].revents == 0) {
+                continue;
+            }
+
+            // The deadline, then the grace after SIGTERM, ran out.
+            uint64_t expirations;
+            read(timerFD, &expirations, sizeof(expirations));
+            if (timedOut == 0) {
+                timedOut = 1;
+                kill(-spawnPid, SIGTERM);
+                armTimer(timerFD, killAfterMs);
+            } else {
+                kill(-spawnPid, SIGKILL);
+            }
+        }
+    }
+    if (pidFD != -1) {
+        close(pidFD);
+    }
+    if (timerFD != -1) {
+        close(timerFD);
+    }
+    while (fan != NULL && pumpFanOut(fan) > 0);
+    while (waitpid(spawnPid, childStatus, 0) == -1 && errno == EINTR);
+    return timedOut;
+}
+
+
+/*
+* Record in the last status that it's child was killed for a timeoutMs 
+* deadline. Like timeout(1) the exit value becomes 124.
+*/
+void setTimedOut(struct shellState* state, long timeoutMs) {
+
+    struct statusStr* lastStatus = state->lastStatus;
+    char message[128];
+    snprintf(message, sizeof(message), "timed out after %gs, %s", timeoutMs / 1000.0, lastStatus->exitStatus);
+    free(lastStatus->exitStatus);
+    lastStatus->exitStatus = malloc((strlen(message) + 1) * sizeof(char));
+    strcpy(lastStatus->exitStatus, message);
+    lastStatus->exitValue = 124;
+    lastStatus->timedOut = timeoutMs;
+    return;
+}
+
+
+/*
+* Hand the terminal on stdin to process group pgid, if the shell's group
+* has it. SIGTTOU is blocked since a background group asking for the 
+* terminal back would otherwise be stopped.
+*/
+void giveTerminal(pid_t pgid) {
+
+    sigset_t blocked, saved;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &blocked, &saved);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    return;
+}
+
+
+/*
+* Parse a list of numbers and ranges such as "0-7,12,14-15" into set.
+* Returns -1 if text is not such a list.
+*/
+int parseIdList(char* text, cpu_set_t* set) {
+
+    CPU_ZERO(set);
+    char* cursor = text;
+    while (*cursor != '\0') {
+        char* end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if (end == cursor || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        for (long id = first; id <= last; id++) {
+            CPU_SET(id, set);
+        }
+        cursor = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+
+/*
+* Apply a placement to the calling (child) process, before exec so the 
+* command and everything it starts inherit it: CPU affinity, the memory
+* policy binding allocations to NUMA nodes, nice value and I/O priority. 
+* Without --cpus, --node also binds the CPUs to those of the nodes. Returns
+* -1 after printing an error.
+*/
+int applyPlacement(struct placement* placement) {
+
+    // CPUs of the nodes, from sysfs.
+    if (placement->hasNodes && placement->hasCpus == 0) {
+        CPU_ZERO(&placement->cpus);
+        for (int node = 0; node < (int) (8 * sizeof(unsigned long)); node++) {
+            if ((placement->nodes & (1UL << node)) == 0) {
+                continue;
+            }
+            char path[64];
+            char cpuList[4096] = "";
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                perror(path);
+                return -1;
+            }
+            ssize_t readAmount = read(fd, cpuList, sizeof(cpuList) - 1);
+            close(fd);
+            cpuList[readAmount > 0 ? readAmount : 0] = '\0';
+            cpuList[strcspn(cpuList, "\n")] = '\0';
+            cpu_set_t nodeCpus;
+            if (parseIdList(cpuList, &nodeCpus) == 0) {
+                CPU_OR(&placement->cpus, &placement->cpus, &nodeCpus);
+            }
+        }
+        placement->hasCpus = 1;
+    }
+
+    if (placement->hasCpus && sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1) {
+        perror("place: sched_setaffinity()");
+        return -1;
+    }
+    if (placement->hasNodes && syscall(SYS_set_mempolicy, MPOL_BIND, &placement->nodes, 8 * sizeof(unsigned long)) == -1) {
+        perror("place: set_mempolicy()");
+        return -1;
+    }
+    if (placement->hasNice) {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0 || setpriority(PRIO_PROCESS, 0, current + placement->niceIncrement) == -1) {
+            perror("place: setpriority()");
+            return -1;
+        }
+    }
+    if (placement->hasIoPriority && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, placement->ioPriority) == -1) {
+        perror("place: ioprio_set()");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+* Resources ulimit can limit: option letter, setrlimit() resource, unit in 
+* bytes or seconds the value is given in, and name. Indexed by LIMIT_*.
+*/
+struct limitResource {
+    char option;
+    int resource;
+    long unit;
+    char* name;
+};
+static const struct limitResource limitResources[LIMIT_AMOUNT] = {
+    { 'v', RLIMIT_AS, 1024, "address space (KiB)" },
+    { 't', RLIMIT_CPU, 1, "cpu time (seconds)" },
+    { 'n', RLIMIT_NOFILE, 1, "open files" },
+    { 'u', RLIMIT_NPROC, 1, "processes" },
+    { 'f', RLIMIT_FSIZE, 1024, "file size (KiB)" },
+};
+
+
+/*
+* Fill effective with the limits a child is launched with: the input's own,
+* else the shell's defaults.
+*/
+void effectiveLimits(struct shellState* state, struct input* userInput, long* effective) {
+
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        effective[i] = (userInput->limits[i] != LIMIT_UNSET) ? userInput->limits[i] : state->defaultLimits[i];
+    }
+    return;
+}
+
+
+/*
+* Apply limits to the calling (child) process before exec. Both the soft and
+* hard limit are lowered so the command cannot raise them again, except that
+* the hard CPU limit is left a second above the soft one: the job gets 
+* SIGXCPU first and SIGKILL only if it ignores it. Limits above the current
+* hard limit cannot be granted and fail. Returns -1 after printing an error.
+*/
+int applyLimits(long* limits) {
+
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        if (limits[i] == LIMIT_UNSET) {
+            continue;
+        }
+        // "unlimited" goes as high as the hard limit allows.
+        struct rlimit current;
+        getrlimit(limitResources[i].resource, &current);
+        struct rlimit limit = current;
+        if (limits[i] == LIMIT_UNLIMITED) {
+            limit.rlim_cur = current.rlim_max;
+        } else {
+            limit.rlim_cur = (rlim_t) limits[i] * limitResources[i].unit;
+            limit.rlim_max = limit.rlim_cur + (i == LIMIT_CPU ? 1 : 0);
+        }
+
+        // Keep the hard limit where it is if that is below what was asked.
+        if (current.rlim_max != RLIM_INFINITY && limit.rlim_max > current.rlim_max) {
+            limit.rlim_max = current.rlim_max;
+        }
+        if (setrlimit(limitResources[i].resource, &limit) == -1) {
+            char message[64];
+            snprintf(message, sizeof(message), "ulimit: %s", limitResources[i].name);
+            perror(message);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+* User plus system CPU time of usage in microseconds.
+*/
+int64_t cpuMicroseconds(struct rusage* usage) {
+
+    return (int64_t) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000 + 
+           usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
+
+/*
+* Write into note which limit a child started with limits was ended by, or
+* an empty string if none was: SIGXCPU and SIGXFSZ are sent for exceeding
+* the CPU time and file size limits. SIGKILL only counts against the CPU
+* limit when cpuUsed shows the child used up it's soft limit, the hard one
+* being a second later, since anyone may send SIGKILL. Running out of 
+* address space is not reported, the exit value does not tell it apart
+* from any other error.
+*/
+void limitNote(int childStatus, long* limits, int64_t cpuUsed, char* note, size_t noteSize) {
+
+    note[0] = '\0';
+    int signal = WIFSIGNALED(childStatus) ? WTERMSIG(childStatus) : 0;
+    if (limits[LIMIT_CPU] >= 0 && (signal == SIGXCPU || (signal == SIGKILL && cpuUsed >= (int64_t) limits[LIMIT_CPU] * 1000000))) {
+        snprintf(note, noteSize, " (cpu time limit of %lds exceeded)", limits[LIMIT_CPU]);
+    } else if (limits[LIMIT_FILESIZE] >= 0 && signal == SIGXFSZ) {
+        snprintf(note, noteSize, " (file size limit of %ld KiB exceeded)", limits[LIMIT_FILESIZE]);
+    }
+    return;
+}
+
+
+/*
+* Pick the CPU for the next background job while jobs are spread: the shell's
+* own allowed CPUs are handed out one after the other. Returns -1 if the
+* affinity could not be read.
+*/
+int nextSpreadCpu(struct shellState* state) {
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || CPU_COUNT(&allowed) == 0) {
+        return -1;
+    }
+    int wanted = state->spreadNext % CPU_COUNT(&allowed);
+    state->spreadNext++;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+
+/*
+* Fork and exec the parsed input, waiting for it unless it runs in the
+* background. Returns the pid of the child.
+*/
+int execFcn(struct shellState* state, struct input* userInput) {
+    
+    // Initialize variables for forking a child process.
+    pid_t spawnPid = -5;
+    int childStatus;
+    int childPid;
+
+    /* Look the command up and build the environment in the parent so the 
+    PATH cache and envp stay warm for the next command. */
+    userInput->resolvedPath = resolveCommand(state, userInput->args[0]);
+    currentEnvironment(state);
+
+    /* Foreground children with a deadline lead their own process group so
+    the whole group can be killed, taking the terminal along if the shell
+    has it. */
+    long timeoutMs = (userInput->timeoutMs >= 0) ? userInput->timeoutMs : state->defaultTimeoutMs;
+    long killAfterMs = (userInput->killAfterMs >= 0) ? userInput->killAfterMs : state->defaultKillAfterMs;
+    int timed = (userInput->bgFlag == 0 && timeoutMs > 0);
+    int ownsTerminal = (timed && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp());
+
+    // Limits the child is launched with.
+    long limits[LIMIT_AMOUNT];
+    effectiveLimits(state, userInput, limits);
+
+    // Background jobs without CPUs of their own take the next CPU while spreading.
+    int spreadCpu = -1;
+    if (userInput->bgFlag == 1 && state->spreadJobs && (userInput->placement == NULL || userInput->placement->hasCpus == 0)) {
+        spreadCpu = nextSpreadCpu(state);
+    }
+
+    // "cmd > a > b" writes into a pipe the shell copies to every file.
+    struct fanOut fan;
+    if (openFanOut(userInput, &fan) == -1) {
+        setStatus(state, 1 << 8);
+        return -1;
+    }
+
+    // Fork a child process. A spawnPid of 0 is the child, a spawnPid > 0 is the parent.
+    int64_t forked = smallshClock(state);
+    state->spawnStarted = forked;
+    spawnPid = fork();
+    switch(spawnPid) {
+        case -1:
+            perror("fork() failed!");
+            break;
+        case 0:
+
+            ;
+
+            /* Set "^C" to default behavior for all foreground child processes,
+            background ones ignore it whatever the shell does with it. */
+            struct sigaction SIGINT_action = {0};
+            struct sigaction SIGTSTP_action = {0};
+            SIGINT_action.sa_handler = (userInput->bgFlag == 0) ? SIG_DFL : SIG_IGN;
+            sigaction(SIGINT, &SIGINT_action, NULL);
+            
+            // Set "^Z" to be ignored by all child processes.
+            SIGTSTP_action.sa_handler = SIG_IGN;
+	        sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+
+            // Set in the child too, whichever of the two runs first.
+            if (timed) {
+                setpgid(0, 0);
+                if (ownsTerminal) {
+                    giveTerminal(getpid());
+                }
+            }
+            
+            // Captured output goes to the state's output fd, unless redirected.
+            if (state->outFD != STDOUT_FILENO) {
+                dup2(state->outFD, STDOUT_FILENO);
+            }
+
+            // Move to the CPUs, nodes and priorities asked for with place.
+            if (userInput->placement != NULL && applyPlacement(userInput->placement) == -1) {
+                exitChild(state, userInput);
+            }
+            if (spreadCpu != -1) {
+                cpu_set_t spreadSet;
+                CPU_ZERO(&spreadSet);
+                CPU_SET(spreadCpu, &spreadSet);
+                sched_setaffinity(0, sizeof(spreadSet), &spreadSet);
+            }
+
+            // Cap the resources it may use.
+            if (applyLimits(limits) == -1) {
+                exitChild(state, userInput);
+            }
+
+            // Output fanned out to several files goes into the shell's pipe.
+            if (fan.amount > 0) {
+                dup2(fan.pipeFDs[1], STDOUT_FILENO);
+            }
+
+            // Handle input and output redirection.
+            userInput = ioRedirection(state, userInput);
+
+            // ioRedirection is not passing back the userInput
+
+            /* Process substitution pipes are close-on-exec so unrelated children
+            never hold them open. This command was handed their /dev/fd/N paths. */
+            for (int i = 0; i < userInput->procSubAmount; i++) {
+                fcntl(userInput->procSubFds[i], F_SETFD, 0);
+            }
+
+            // Execute the remaining commands and arguments after i/o redirection is done.
+            execCommand(state, userInput);
+            
+            // Exec only returns if there is an error.
+            char* message = malloc((strlen(userInput->args[0]) + 3) * sizeof(char));
+            strcpy(message, userInput->args[0]);
+            strcat(message, ": ");
+            write(STDOUT_FILENO, message, strlen(message));
+            fflush(stdout);
+            perror("");
+            free(message);
+
+            // Reset runStatus of child.
+            if (userInput->bgFlag == 1) {
+                state->bgList->runStatus = 0;
+            }
+
+            /* Call exit function to clear all dynamic memory in child,
+            set error status to 1 and terminate child. */
+            exitChild(state, userInput);
+        default:
+            ;
+            struct commandStats* stats = commandStats(state, userInput->args[0]);
+            recordMetric(state, METRIC_SPAWN, stats, forked);
+
+            // Only the child writes into a fan-out.
+            if (fan.amount > 0) {
+                close(fan.pipeFDs[1]);
+                fan.pipeFDs[1] = -1;
+            }
+            
+            // Determine if the child will run in the forground or background.
+            if (userInput->bgFlag == 0) {
+
+                /* The CPU time of the child is what the resource usage of 
+                reaped children grows by while it is waited for. */
+                struct rusage usageBefore;
+                getrusage(RUSAGE_CHILDREN, &usageBefore);
+
+                /* Forground process. Wait for the child process to end, save the childPid returned,
+                save the child exit status in childStatus so that we can refer to it
+                later using the status command. Children with a deadline are watched
+                until it passes, then the terminal is taken back. */
+                if (timed) {
+                    setpgid(spawnPid, spawnPid);
+                    if (ownsTerminal) {
+                        giveTerminal(spawnPid);
+                    }
+                    int timedOut = waitTimed(state, spawnPid, timeoutMs, killAfterMs, &childStatus, (fan.amount > 0) ? &fan : NULL);
+                    if (ownsTerminal) {
+                        giveTerminal(getpgrp());
+                    }
+                    setStatus(state, childStatus);
+                    if (timedOut) {
+                        setTimedOut(state, timeoutMs);
+                    }
+                } else if (fan.amount > 0) {
+                    waitTimed(state, spawnPid, 0, 0, &childStatus, &fan);
+                    setStatus(state, childStatus);
+                } else {
+                    childPid = waitpid(spawnPid, &childStatus, 0);
+                    setStatus(state, childStatus);
+                }
+                recordMetric(state, METRIC_RUN, stats, forked);
+
+                // Explain deaths a resource limit is behind.
+                struct rusage usage;
+                getrusage(RUSAGE_CHILDREN, &usage);
+                char note[96];
+                limitNote(childStatus, limits, cpuMicroseconds(&usage) - cpuMicroseconds(&usageBefore), note, sizeof(note));
+                if (note[0] != '\0') {
+                    char* exitStatus = malloc((strlen(state->lastStatus->exitStatus) + strlen(note) + 1) * sizeof(char));
+                    strcpy(exitStatus, state->lastStatus->exitStatus);
+                    strcat(exitStatus, note);
+                    free(state->lastStatus->exitStatus);
+                    state->lastStatus->exitStatus = exitStatus;
+                }
+
+                /* Tell the user about foreground children killed by a signal,
+                unless the output is captured: callers get it as a status. */
+                if (WIFEXITED(childStatus) == 0 && state->capturing == 0) {
+                    status(state);
+                }
+
+            } else if (userInput->bgFlag == 1) {
+        
+                /* Background process. Return control to the parent. If the child
+                has not returned, waitpid will return a childPid of 0. */
+                childPid = waitpid(spawnPid, &childStatus, WNOHANG);
+
+                /* The shell cannot copy a background job's output while taking
+                commands, a forked copy of it does, reaped like a feeder. */
+                if (fan.amount > 0) {
+                    pid_t pumpPid = fork();
+                    if (pumpPid == 0) {
+                        struct sigaction ignoreAction = {0};
+                        ignoreAction.sa_handler = SIG_IGN;
+                        sigaction(SIGINT, &ignoreAction, NULL);
+                        sigaction(SIGTSTP, &ignoreAction, NULL);
+                        while (pumpFanOut(&fan) > 0);
+                        exit(0);
+                    }
+                    if (pumpPid > 0) {
+                        createNode(state->bgList, pumpPid);
+                        state->bgList->tail->procSub = 1;
+                    }
+                }
+
+                /* Notify the user that the child is now running in the background,
+                written with the next batch of shell messages. */
+                outputConstant(&state->output, "background pid is ");
+                outputNumber(&state->output, spawnPid);
+                outputConstant(&state->output, "\n");
+            }
+            break;
+    }
+    closeFanOut(&fan);
+    return spawnPid;
+}
+
+/*
+* Helper function to create new nodes for linked list "bgList"
+*/
+struct bgProcess* createNode(struct bgProcess* bgList, int childPid) {
+
+    // Initialize a new node for linked list "bgList"
+    struct bgProcess* newNode = malloc(sizeof(struct bgProcess));
+    newNode->pid = childPid;
+    newNode->runStatus = 1;
+    newNode->procSub = 0;
+    newNode->started = 0;
+    newNode->stats = NULL;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        newNode->limits[i] = LIMIT_UNSET;
+    }
+    newNode->pidFD = syscall(SYS_pidfd_open, childPid, 0);
+    newNode->reaped = 0;
+    newNode->waitStatus = 0;
+    newNode->cpuUsed = 0;
+    newNode->next = NULL;
+                
+    // Is this the first node in the linked list?
+    if (bgList->head == NULL) {
+
+        // This is the first node, set the head and tail to this node 
+        bgList->head = newNode;
+        bgList->tail = newNode;
+        newNode->head = bgList->head;
+    } else {
+
+        // This is not the first node
+        bgList->tail->next = newNode;
+        bgList->tail = newNode;
+        newNode->head = bgList->head;
+    }
+    return bgList;
+}
+
+/*
+* Run an already parsed input in the current (child) process: apply it's
+* redirections and exec it. Used by the children of process and command
+* substitution. Never returns.
+*/
+void execParsedInput(struct shellState* state, struct input* subInput) {
+
+    // Hand process substitution pipes of this input across the exec.
+    for (int i = 0; i < subInput->procSubAmount; i++) {
+        fcntl(subInput->procSubFds[i], F_SETFD, 0);
+    }
+    subInput = ioRedirection(state, subInput);
+    execCommand(state, subInput);
+
+    // Exec only returns if there is an error.
+    char* message = malloc((strlen(subInput->args[0]) + 3) * sizeof(char));
+    strcpy(message, subInput->args[0]);
+    strcat(message, ": ");
+    write(STDERR_FILENO, message, strlen(message));
+    perror("");
+    free(message);
+    exitChild(state, subInput);
+}
+
+
+/*
+* Read everything from fd into capture until end of file. The buffer starts at
+* 64KiB and doubles, and each read() asks for all of the remaining capacity so
+* large outputs are moved in a few big chunks.
+*/
+void readAllFD(int fd, struct captureBuffer* capture) {
+
+    while (1) {
+
+        // Grow the buffer once less than 64KiB of it is free.
+        if (capture->capacity - capture->length < 65536) {
+            capture->capacity = (capture->capacity == 0) ? 65536 : capture->capacity * 2;
+            capture->data = realloc(capture->data, capture->capacity + 1);
+        }
+
+        ssize_t readLen = read(fd, capture->data + capture->length, capture->capacity - capture->length);
+        if (readLen == -1 && errno == EINTR) {
+            errno = 0;
+            continue;
+        }
+        if (readLen <= 0) {
+            break;
+        }
+        capture->length += readLen;
+    }
+    capture->data[capture->length] = '\0';
+    return;
+}
+
+
+/*
+* Run the builtin named by subInput->args[0] in process with the state's
+* output fd pointed at an anonymous memory file, capturing what it writes 
+* without a fork. Returns 1 if args[0] was such a builtin, 0 otherwise.
+*/
+int captureBuiltin(struct shellState* state, struct input* subInput, struct captureBuffer* capture) {
+
+    // Only builtins that do nothing but write output may run in process.
+    int builtin = builtinHash(subInput->args[0]);
+    if (builtin != 697 && (builtin != 318 || catOptions(subInput))) {
+        return 0;
+    }
+
+    // Point output at a memory file for the duration of the builtin.
+    int memFD = memfd_create("smallsh-capture", MFD_CLOEXEC);
+    if (memFD == -1) {
+        return 0;
+    }
+    int savedOutFD = state->outFD;
+    state->outFD = memFD;
+
+    if (builtin == 697) {
+        status(state);
+    } else {
+        catFiles(state, subInput);
+    }
+
+    // Restore the output fd and read back what the builtin wrote.
+    state->outFD = savedOutFD;
+    lseek(memFD, 0, SEEK_SET);
+    readAllFD(memFD, capture);
+    close(memFD);
+    return 1;
+}
+
+
+/*
+* Run the command line text and return everything it wrote to stdout, minus
+* trailing newlines. A lone builtin runs in process, anything else in a child
+* whose stdout is a pipe read by readAllFD().
+*/
+char* captureCommand(struct shellState* state, char* text) {
+
+    struct captureBuffer capture = { NULL, 0, 0 };
+
+    // Empty, comment only or invalid substitutions produce nothing.
+    struct commandNode* tree;
+    if (parseCommandLine(text, &tree) == -1 || tree == NULL) {
+        return calloc(1, sizeof(char));
+    }
+
+    /* Try the in process path first. Whether it applies is decided from the 
+    command name as typed, before anything is expanded, so substitutions 
+    nested in the words run once. If the builtin still declines, the child
+    is handed the words already expanded. */
+    int captured = 0;
+    struct input* subInput = NULL;
+    struct commandNode* single = singleCommand(tree);
+    int builtin = (single != NULL && single->literal[0]) ? builtinHash(single->words[0]) : -1;
+    if ((builtin == 697 || builtin == 318) && findDefinition(state, single->words[0], DEFINITION_ALIAS) == NULL
+        && findDefinition(state, single->words[0], DEFINITION_FUNCTION) == NULL) {
+        subInput = expandCommand(state, single);
+        captured = captureBuiltin(state, subInput, &capture);
+        if (captured) {
+            freeUserInput(subInput);
+            subInput = NULL;
+        }
+    }
+
+    if (captured == 0) {
+
+        int pipeFDs[2];
+        if (pipe2(pipeFDs, O_CLOEXEC) == -1) {
+            perror("command substitution: pipe2()");
+            if (subInput != NULL) {
+                freeUserInput(subInput);
+            }
+            freeCommandNode(tree);
+            return calloc(1, sizeof(char));
+        }
+
+        pid_t spawnPid = fork();
+        switch (spawnPid) {
+            case -1:
+                perror("command substitution: fork()");
+                close(pipeFDs[0]);
+                close(pipeFDs[1]);
+                if (subInput != NULL) {
+                    freeUserInput(subInput);
+                }
+                freeCommandNode(tree);
+                return calloc(1, sizeof(char));
+            case 0:
+                ;
+
+                // Behave as a foreground child: "^C" ends it, "^Z" is ignored.
+                struct sigaction childAction = {0};
+                childAction.sa_handler = SIG_DFL;
+                sigaction(SIGINT, &childAction, NULL);
+                childAction.sa_handler = SIG_IGN;
+                sigaction(SIGTSTP, &childAction, NULL);
+
+                dup2(pipeFDs[1], STDOUT_FILENO);
+                close(pipeFDs[0]);
+                close(pipeFDs[1]);
+                state->outFD = STDOUT_FILENO;
+                state->capturing = 1;
+                if (subInput != NULL) {
+                    execInputInChild(state, subInput);
+                }
+                execNodeInChild(state, tree);
+            default:
+                break;
+        }
+
+        /* Drain the pipe until the child closes it, then reap the child. The
+        parent's ends of process substitution pipes are closed first. */
+        if (subInput != NULL) {
+            freeUserInput(subInput);
+        }
+        close(pipeFDs[1]);
+        readAllFD(pipeFDs[0], &capture);
+        close(pipeFDs[0]);
+        int childStatus;
+        waitpid(spawnPid, &childStatus, 0);
+    }
+    freeCommandNode(tree);
+
+    // Trailing newlines are dropped as every shell does.
+    while (capture.length > 0 && capture.data[capture.length-1] == '\n') {
+        capture.length--;
+    }
+    capture.data[capture.length] = '\0';
+    return capture.data;
+}
+
+
+/*
+* Command substitution. Return a copy of token with every "$(cmd)" replaced by
+* the output of cmd. Field splitting of the result is left to the caller.
+*/
+char* commandSubstitution(struct shellState* state, char* token) {
+
+    struct captureBuffer result = { NULL, 0, 0 };
+    result.capacity = strlen(token) + 1;
+    result.data = malloc(result.capacity);
+
+    char* current = token;
+    while (*current != '\0') {
+
+        // Find the parenthesis closing a "$(" and capture the text between.
+        char* substitution = NULL;
+        size_t innerLen = 0;
+        if (current[0] == '$' && current[1] == '(') {
+            int depth = 0;
+            for (char* end = current + 1; *end != '\0'; end++) {
+                if (*end == '(') {
+                    depth++;
+                } else if (*end == ')' && --depth == 0) {
+                    innerLen = end - current - 2;
+                    char* inner = calloc(innerLen + 1, sizeof(char));
+                    strncpy(inner, current + 2, innerLen);
+                    substitution = captureCommand(state, inner);
+                    free(inner);
+                    break;
+                }
+            }
+        }
+
+        // Append either the captured output or the current character.
+        size_t appendLen = (substitution != NULL) ? strlen(substitution) : 1;
+        if (result.length + appendLen + 1 > result.capacity) {
+            result.capacity = (result.length + appendLen + 1) * 2;
+            result.data = realloc(result.data, result.capacity);
+        }
+        if (substitution != NULL) {
+            memcpy(result.data + result.length, substitution, appendLen);
+            free(substitution);
+            current += innerLen + 3;
+        } else {
+            result.data[result.length] = *current;
+            current++;
+        }
+        result.length += appendLen;
+    }
+    result.data[result.length] = '\0';
+    return result.data;
+}
+
+
+/*
+* Process substitution. Start the command inside a "<(cmd)" or ">(cmd)" token
+* concurrently on a pipe and return the "/dev/fd/N" path of the parent's end 
+* of that pipe, to be used as an argument of the outer command. The feeder is
+* tracked in bgList so it is reaped like any other child. Returns NULL if the
+* pipe or child could not be created.
+*/
+char* processSubstitution(struct shellState* state, char* token, struct input* userInput) {
+
+    // "<(cmd)" is read by the outer command, ">(cmd)" is written by it.
+    int readByOuter = (token[0] == '<');
+
+    // Limit the amount of substitutions to the amount of fds we can record.
+    if (userInput->procSubAmount >= 64) {
+        char* message = "process substitution: too many substitutions\n";
+        write(STDOUT_FILENO, message, strlen(message));
+        fflush(stdout);
+        return NULL;
+    }
+
+    /* Create the pipe close-on-exec so it does not leak into other children,
+    the outer command clears the flag on its own end before exec. */
+    int pipeFDs[2];
+    if (pipe2(pipeFDs, O_CLOEXEC) == -1) {
+        perror("process substitution: pipe2()");
+        return NULL;
+    }
+
+    pid_t feederPid = fork();
+    switch (feederPid) {
+        case -1:
+            perror("process substitution: fork()");
+            close(pipeFDs[0]);
+            close(pipeFDs[1]);
+            return NULL;
+        case 0:
+            ;
+
+            // Feeders are background children, ignore "^C" and "^Z".
+            struct sigaction SIGTSTP_action = {0};
+            SIGTSTP_action.sa_handler = SIG_IGN;
+            sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+            sigaction(SIGINT, &SIGTSTP_action, NULL);
+
+            // Attach the feeder's stdout or stdin to its end of the pipe.
+            if (state->outFD != STDOUT_FILENO) {
+                dup2(state->outFD, STDOUT_FILENO);
+                state->outFD = STDOUT_FILENO;
+            }
+            if (readByOuter) {
+                dup2(pipeFDs[1], STDOUT_FILENO);
+            } else {
+                dup2(pipeFDs[0], STDIN_FILENO);
+            }
+            close(pipeFDs[0]);
+            close(pipeFDs[1]);
+
+            /* Parse the text between the parentheses and run it the same way
+            a foreground command is run. */
+            char* inner = calloc(strlen(token) - 2, sizeof(char));
+            strncpy(inner, token + 2, strlen(token) - 3);
+            struct commandNode* tree;
+            if (parseCommandLine(inner, &tree) == -1) {
+                exit(2);
+            }
+            execNodeInChild(state, tree);
+        default:
+            break;
+    }
+
+    // Keep the outer command's end of the pipe and track the feeder.
+    int keptFD = readByOuter ? pipeFDs[0] : pipeFDs[1];
+    close(readByOuter ? pipeFDs[1] : pipeFDs[0]);
+    userInput->procSubFds[userInput->procSubAmount] = keptFD;
+    userInput->procSubAmount++;
+    createNode(state->bgList, feederPid);
+    state->bgList->tail->procSub = 1;
+
+    // Build the "/dev/fd/N" path handed to the outer command.
+    char* path = malloc((strlen("/dev/fd/") + digitCount(keptFD) + 1) * sizeof(char));
+    sprintf(path, "/dev/fd/%d", keptFD);
+    return path;
+}
+
+
+/*
+* Reap the background job if it has ended, keeping it's wait status and CPU
+* time for checkBgProcesses() to report. exited is when the shell saw it end
+* through it's pidfd, 0 if it did not: the time from fork to exit and from
+* exit to reap are recorded only when that is known, as the exit of a job
+* the shell did not watch could have been any time since the last check.
+* Returns 1 once the job is reaped.
+*/
+int reapJob(struct shellState* state, struct bgProcess* job, int64_t exited) {
+
+    if (job->reaped == 1) {
+        return 1;
+    }
+    struct rusage usage = {0};
+    if (wait4(job->pid, &job->waitStatus, WNOHANG, &usage) == 0) {
+        return 0;
+    }
+    job->reaped = 1;
+    job->cpuUsed = cpuMicroseconds(&usage);
+    if (job->pidFD != -1) {
+        close(job->pidFD);
+        job->pidFD = -1;
+    }
+    if (exited != 0 && job->procSub == 0) {
+        recordMetric(state, METRIC_RUN, job->stats, job->started);
+        recordMetric(state, METRIC_REAP, job->stats, exited);
+    }
+    return 1;
+}
+
+
+/*
+* Examine and reap all terminated background processes before returning
+* control of the shell to the user.
+*/
+void checkBgProcesses(struct shellState* state) {
+
+    struct bgProcess* bgList = state->bgList;
+
+    // Sleep for 1/20th of a second to catch immedietly ending bg processes.
+    struct timespec time;
+        time.tv_sec = .5;
+        time.tv_nsec = 50000000;
+        nanosleep(&time, &time);
+
+    // Loop through the linked list of background processes.
+    while(bgList != NULL) {
+        
+        // Initialize variables for waitpid.
+        int wstatus;
+        int status;
+
+        if (bgList->pid != -1 && bgList->runStatus == 1) {
+
+            /* If a processes is reaped. The next loop, it's still recorded in the linked list
+            and causes an error. Jobs may have been reaped at the prompt already. */
+            int reaped = reapJob(state, bgList, 0);
+            wstatus = bgList->waitStatus;
+
+            /* Process substitution feeders are not user jobs, reap them 
+            without a completion message. */
+            if (reaped && bgList->procSub == 1) {
+                bgList->pid = -1;
+                bgList->runStatus = 0;
+            }
+
+            // The process has been reaped.
+            else if (reaped) {
+
+                // Exit value, or the signal that ended it.
+                char* msg3 = " is done: exit value ";
+                if (WIFEXITED(wstatus) == 1) {
+                    status = WEXITSTATUS(wstatus);
+                } else {
+                    status = WTERMSIG(wstatus);
+                    msg3 = " is done: terminated by signal ";
+                }
+
+                /* Queue the message for the terminal, all of them go out with the 
+                next prompt. */
+                char note[96];
+                limitNote(wstatus, bgList->limits, bgList->cpuUsed, note, sizeof(note));
+                outputConstant(&state->output, "background pid ");
+                outputNumber(&state->output, bgList->pid);
+                outputConstant(&state->output, msg3);
+                outputNumber(&state->output, status);
+                outputText(&state->output, note);
+                outputConstant(&state->output, "\n");
+
+                // Set pid and run status to default values after handled.
+                bgList->pid = -1;
+                bgList->runStatus = 0;
+            }
+        }
+        bgList = bgList->next;
+    }
+}
+
+
+
+
+/*
+* Milliseconds of CLOCK_MONOTONIC, for the age of prompt segments.
+*/
+int64_t monotonicMs(void) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*
+* Number of background jobs still running, for "\j" in the prompt.
+*/
+int runningJobs(struct shellState* state) {
+
+    int jobs = 0;
+    for (struct bgProcess* job = state->bgList->head; job != NULL; job = job->next) {
+        if (job->pid != -1 && job->runStatus == 1 && job->procSub == 0) {
+            jobs++;
+        }
+    }
+    return jobs;
+}
+
+
+/*
+* Cache entry of command in the directory cwd. A new one replaces the
+* least recently used entry that has no child running. Returns NULL if
+* every entry is busy.
+*/
+struct promptSegment* promptSegment(struct shellState* state, char* cwd, char* command, size_t commandLen) {
+
+    struct promptSegment* oldest = NULL;
+    for (int i = 0; i < PROMPT_CACHE; i++) {
+        struct promptSegment* segment = &state->promptCache[i];
+        if (segment->command != NULL && strlen(segment->command) == commandLen && strncmp(segment->command, command, commandLen) == 0 
+            && strcmp(segment->cwd, cwd) == 0) {
+            return segment;
+        }
+        if (segment->pid == 0 && (oldest == NULL || segment->lastUsed < oldest->lastUsed)) {
+            oldest = segment;
+        }
+    }
+    if (oldest == NULL) {
+        return NULL;
+    }
+    free(oldest->command);
+    free(oldest->value);
+    oldest->command = calloc(commandLen + 1, sizeof(char));
+    strncpy(oldest->command, command, commandLen);
+    strcpy(oldest->cwd, cwd);
+    oldest->value = NULL;
+    oldest->lastUsed = 0;
+    return oldest;
+}
+
+
+/*
+* Start a child computing a fresh value of segment, unless one already is. 
+* It gets a process group of it's own so "^C" at the prompt does not reach
+* it, /dev/null as stdin and stderr, and a non blocking pipe as stdout.
+*/
+void startPromptSegment(struct shellState* state, struct promptSegment* segment) {
+
+    if (segment->pid != 0) {
+        return;
+    }
+    struct commandNode* tree;
+    if (parseCommandLine(segment->command, &tree) == -1 || tree == NULL) {
+        return;
+    }
+    int pipeFDs[2];
+    if (pipe2(pipeFDs, O_CLOEXEC) == -1) {
+        freeCommandNode(tree);
+        return;
+    }
+
+    pid_t spawnPid = fork();
+    switch (spawnPid) {
+        case -1:
+            close(pipeFDs[0]);
+            close(pipeFDs[1]);
+            freeCommandNode(tree);
+            return;
+        case 0:
+            ;
+            setpgid(0, 0);
+            struct sigaction childAction = {0};
+            childAction.sa_handler = SIG_DFL;
+            sigaction(SIGINT, &childAction, NULL);
+            childAction.sa_handler = SIG_IGN;
+            sigaction(SIGTSTP, &childAction, NULL);
+
+            int nullFD = open("/dev/null", O_RDWR);
+            dup2(nullFD, STDIN_FILENO);
+            dup2(nullFD, STDERR_FILENO);
+            dup2(pipeFDs[1], STDOUT_FILENO);
+            close(nullFD);
+            close(pipeFDs[0]);
+            close(pipeFDs[1]);
+
+            // Drop the half drawn prompt the output buffer holds.
+            state->outFD = STDOUT_FILENO;
+            outputInit(&state->output, STDOUT_FILENO);
+            execNodeInChild(state, tree);
+        default:
+            break;
+    }
+    setpgid(spawnPid, spawnPid);
+    close(pipeFDs[1]);
+    fcntl(pipeFDs[0], F_SETFL, O_NONBLOCK);
+    freeCommandNode(tree);
+    segment->pid = spawnPid;
+    segment->fd = pipeFDs[0];
+    segment->pendingLength = 0;
+    segment->started = monotonicMs();
+    return;
+}
+
+
+/*
+* Stop the child of segment, killing it's process group if force is set,
+* and reap it.
+*/
+void stopPromptSegment(struct promptSegment* segment, int force) {
+
+    if (force && killpg(segment->pid, SIGKILL) == -1) {
+        kill(segment->pid, SIGKILL);
+    }
+    close(segment->fd);
+    int childStatus;
+    while (waitpid(segment->pid, &childStatus, 0) == -1 && errno == EINTR);
+    segment->pid = 0;
+    segment->fd = -1;
+    return;
+}
+
+
+/*
+* Read what the child of segment wrote so far. Once it closed the pipe the
+* output becomes the segment's value, as one line without the trailing 
+* newlines and cut at PROMPT_SEGMENT_MAX. Returns 1 if the value changed.
+*/
+int readPromptSegment(struct promptSegment* segment) {
+
+    char discard[4096];
+    while (1) {
+        char* into = segment->pending + segment->pendingLength;
+        size_t room = PROMPT_SEGMENT_MAX - 1 - segment->pendingLength;
+        if (room == 0) {
+            into = discard;
+            room = sizeof(discard);
+        }
+        ssize_t readLen = read(segment->fd, into, room);
+        if (readLen == -1 && errno == EINTR) {
+            continue;
+        }
+        if (readLen == -1) {
+            return 0;
+        }
+        if (readLen == 0) {
+            break;
+        }
+        if (into != discard) {
+            segment->pendingLength += readLen;
+        }
+    }
+    stopPromptSegment(segment, 0);
+
+    while (segment->pendingLength > 0 && segment->pending[segment->pendingLength-1] == '\n') {
+        segment->pendingLength--;
+    }
+    segment->pending[segment->pendingLength] = '\0';
+    for (size_t i = 0; i < segment->pendingLength; i++) {
+        if (segment->pending[i] == '\n' || segment->pending[i] == '\r') {
+            segment->pending[i] = ' ';
+        }
+    }
+    int changed = (segment->value == NULL || strcmp(segment->value, segment->pending) != 0);
+    if (changed) {
+        free(segment->value);
+        segment->value = malloc(segment->pendingLength + 1);
+        strcpy(segment->value, segment->pending);
+    }
+    return changed;
+}
+
+
+/*
+* Read the segments whose children have output waiting, without blocking,
+* and kill those running past PROMPT_SEGMENT_TIMEOUT_MS. Returns 1 if a 
+* value changed.
+*/
+int collectPromptSegments(struct shellState* state) {
+
+    int changed = 0;
+    int64_t now = monotonicMs();
+    for (int i = 0; i < PROMPT_CACHE; i++) {
+        struct promptSegment* segment = &state->promptCache[i];
+        if (segment->pid == 0) {
+            continue;
+        }
+        struct pollfd ready = { segment->fd, POLLIN, 0 };
+        if (poll(&ready, 1, 0) == 1) {
+            changed |= readPromptSegment(segment);
+        } else if (now - segment->started > PROMPT_SEGMENT_TIMEOUT_MS) {
+            stopPromptSegment(segment, 1);
+        }
+    }
+    return changed;
+}
+
+
+/*
+* Add PS1 to output with it's escapes replaced:
+*   \w  current directory, $HOME shown as ~     \W  last part of it
+*   \j  running background jobs                 \?  exit value of the last command
+*   \(cmd)  output of cmd, computed in the background and cached
+*   \_  space    \n  newline    \\  backslash
+* Other characters are copied as they are. Children for the "\(cmd)" 
+* segments are started when refresh is set. Stores the lines it took.
+*/
+void writePrompt(struct shellState* state, struct outputBuffer* output, int refresh) {
+
+    char* ps1 = getVariable(state, "PS1");
+    if (ps1 == NULL) {
+        outputConstant(output, ": ");
+        state->promptLines = 1;
+        return;
+    }
+
+    /* The directory is read again rather than taken from savedPWD, cd does
+    not always keep it up to date. HOME is the shell's, as cd uses it. */
+    state->promptLines = 1;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    char* home = getVariable(state, "HOME");
+    for (char* current = ps1; *current != '\0'; current++) {
+
+        // Plain text up to the next escape.
+        if (current[0] != '\\') {
+            char text[OUTPUT_BUFFER_SIZE];
+            size_t textLen = strcspn(current, "\\");
+            size_t copyLen = (textLen < sizeof(text)) ? textLen : sizeof(text) - 1;
+            memcpy(text, current, copyLen);
+            text[copyLen] = '\0';
+            outputText(output, text);
+            current += textLen - 1;
+            continue;
+        }
+
+        current++;
+        char unknown[3] = { '\\', *current, '\0' };
+        switch (*current) {
+            case 'w':
+                if (home != NULL && home[0] != '\0' && strncmp(cwd, home, strlen(home)) == 0 
+                    && (cwd[strlen(home)] == '/' || cwd[strlen(home)] == '\0')) {
+                    outputConstant(output, "~");
+                    outputText(output, cwd + strlen(home));
+                } else {
+                    outputText(output, cwd);
+                }
+                break;
+            case 'W':
+                ;
+                char* base = strrchr(cwd, '/');
+                outputText(output, (base != NULL && base[1] != '\0') ? base + 1 : cwd);
+                break;
+            case 'j':
+                outputNumber(output, runningJobs(state));
+                break;
+            case '?':
+                outputNumber(output, state->lastCode);
+                break;
+            case '_':
+                outputConstant(output, " ");
+                break;
+            case '\\':
+                outputConstant(output, "\\");
+                break;
+            case 'n':
+                outputConstant(output, "\n");
+                state->promptLines++;
+                break;
+            case '(':
+                ;
+
+                // The command runs to the parenthesis closing this one.
+                int depth = 1;
+                char* end = current + 1;
+                while (*end != '\0' && (*end != ')' || --depth > 0)) {
+                    depth += (*end == '(');
+                    end++;
+                }
+                struct promptSegment* segment = promptSegment(state, cwd, current + 1, end - current - 1);
+                if (segment != NULL) {
+                    segment->lastUsed = state->promptCount;
+                    if (refresh) {
+                        startPromptSegment(state, segment);
+                    }
+                    if (segment->value != NULL) {
+                        outputText(output, segment->value);
+                    }
+                }
+                current = (*end == '\0') ? end - 1 : end;
+                break;
+            case '\0':
+                outputConstant(output, "\\");
+                return;
+            default:
+                outputText(output, unknown);
+                break;
+        }
+    }
+    return;
+}
+
+
+/*
+* Add the prompt to state->output, refreshing it's "\(cmd)" segments in
+* the background.
+*/
+void smallshPrompt(struct shellState* state) {
+
+    collectPromptSegments(state);
+    state->promptCount++;
+    writePrompt(state, &state->output, 1);
+    return;
+}
+
+
+/*
+* Wait for inputFD, redrawing the prompt each time one of it's segments gets
+* a new value: back to the start of it's first line, clear to the end of
+* the screen and draw it again. A line typed but not yet entered is not 
+* drawn again, it is still read as typed ("^R" shows it). Background jobs
+* that end meanwhile are reaped at once through their pidfds, so their run
+* time is not stretched by the time the user takes to type, they are still
+* reported with the next prompt.
+*/
+void smallshPromptWait(struct shellState* state, int inputFD) {
+
+    int watchAmount = PROMPT_CACHE + 1;
+    for (struct bgProcess* job = state->bgList->head; job != NULL; job = job->next) {
+        watchAmount += (job->pidFD != -1) ? 1 : 0;
+    }
+    struct pollfd* ready = malloc(watchAmount * sizeof(struct pollfd));
+    struct promptSegment** segments = malloc(watchAmount * sizeof(struct promptSegment*));
+    struct bgProcess** jobs = malloc(watchAmount * sizeof(struct bgProcess*));
+    while (1) {
+
+        // Input first, then every segment with a child running, then the jobs.
+        int readyAmount = 1;
+        ready[0].fd = inputFD;
+        ready[0].events = POLLIN;
+        int64_t deadline = -1;
+        for (int i = 0; i < PROMPT_CACHE; i++) {
+            struct promptSegment* segment = &state->promptCache[i];
+            if (segment->pid != 0) {
+                segments[readyAmount] = segment;
+                ready[readyAmount].fd = segment->fd;
+                ready[readyAmount].events = POLLIN;
+                readyAmount++;
+                int64_t left = segment->started + PROMPT_SEGMENT_TIMEOUT_MS - monotonicMs();
+                left = (left < 0) ? 0 : left;
+                deadline = (deadline == -1 || left < deadline) ? left : deadline;
+            }
+        }
+        int segmentEnd = readyAmount;
+        for (struct bgProcess* job = state->bgList->head; job != NULL && readyAmount < watchAmount; job = job->next) {
+            if (job->pidFD != -1) {
+                jobs[readyAmount] = job;
+                ready[readyAmount].fd = job->pidFD;
+                ready[readyAmount].events = POLLIN;
+                readyAmount++;
+            }
+        }
+        if (readyAmount == 1) {
+            break;
+        }
+
+        int readyCount = poll(ready, readyAmount, (int) deadline);
+        if (readyCount == -1 && errno != EINTR) {
+            break;
+        }
+        if (readyCount > 0 && ready[0].revents != 0) {
+            break;
+        }
+
+        // Reap the jobs that ended, which closes their pidfds.
+        int64_t exited = smallshClock(state);
+        for (int i = segmentEnd; i < readyAmount && readyCount > 0; i++) {
+            if (ready[i].revents != 0) {
+                reapJob(state, jobs[i], exited);
+            }
+        }
+
+        // Read the segments that finished, drop those running too long.
+        int changed = 0;
+        for (int i = 1; i < segmentEnd && readyCount > 0; i++) {
+            if (ready[i].revents != 0) {
+                changed |= readPromptSegment(segments[i]);
+            }
+        }
+        changed |= collectPromptSegments(state);
+        if (changed) {
+            outputConstant(&state->output, "\r");
+            if (state->promptLines > 1) {
+                outputConstant(&state->output, "\033[");
+                outputNumber(&state->output, state->promptLines - 1);
+                outputConstant(&state->output, "A");
+            }
+            outputConstant(&state->output, "\033[J");
+            writePrompt(state, &state->output, 0);
+            outputFlush(&state->output);
+        }
+    }
+    free(ready);
+    free(segments);
+    free(jobs);
+    return;
+}
+
+
+/*
+* Kill and reap the children computing prompt segments.
+*/
+void stopPromptSegments(struct shellState* state) {
+
+    for (int i = 0; i < PROMPT_CACHE; i++) {
+        if (state->promptCache[i].pid != 0) {
+            stopPromptSegment(&state->promptCache[i], 1);
+        }
+    }
+    return;
+}
+
+
+/*
+* Fork and exec an input that is not a builtin. Returns it's exit value, 0
+* if it went to the background.
+*/
+int runExternal(struct shellState* state, struct input* userInput) {
+
+    /* The last command of a "smallsh -c" line replaces the shell when it
+    needs no deadline watched and no output copied, so it costs no fork. */
+    long timeoutMs = (userInput->timeoutMs >= 0) ? userInput->timeoutMs : state->defaultTimeoutMs;
+    if (userInput->tailExec && userInput->bgFlag == 0 && timeoutMs <= 0 && outputRedirections(userInput) < 2) {
+        long limits[LIMIT_AMOUNT];
+        effectiveLimits(state, userInput, limits);
+        userInput->resolvedPath = resolveCommand(state, userInput->args[0]);
+        if ((userInput->placement != NULL && applyPlacement(userInput->placement) == -1) || applyLimits(limits) == -1) {
+            return 1;
+        }
+        execParsedInput(state, userInput);
+    }
+
+    int result = 0;
+    int spawnPid = execFcn(state, userInput);
+
+    // Add background children to a linked list for tracking.
+    if (spawnPid == -1) {
+        result = 1;
+    } else if (userInput->bgFlag == 1) {
+        createNode(state->bgList, spawnPid);
+        effectiveLimits(state, userInput, state->bgList->tail->limits);
+        state->bgList->tail->started = state->spawnStarted;
+        state->bgList->tail->stats = commandStats(state, userInput->args[0]);
+    } else {
+        result = state->lastStatus->exitValue;
+
+        // A foreground child ended by "^C" stops the rest of the commands.
+        if (state->lastStatus->termSignal == SIGINT) {
+            state->interrupted = 1;
+        }
+    }
+    return result;
+}
+
+
+/*
+* timeout builtin. "timeout [-k GRACE] DURATION cmd..." runs cmd with a deadline
+* enforced by the shell: SIGTERM to it's process group once DURATION passes,
+* SIGKILL GRACE later (5s by default). Without cmd it sets the deadline of 
+* every foreground command instead, 0 for none, and plain "timeout" shows it.
+* Returns 1 with userInput cut down to cmd and it's deadline set if cmd must
+* be run, 0 with *result set otherwise.
+*/
+int timeoutCommand(struct shellState* state, struct input* userInput, int* result) {
+
+    // Options and the duration.
+    int position = 1;
+    long killAfterMs = -1;
+    if (userInput->argAmount > 2 && strcmp(userInput->args[1], "-k") == 0) {
+        killAfterMs = parseDuration(userInput->args[2]);
+        position = 3;
+        if (killAfterMs == -1) {
+            position = -1;
+        }
+    }
+    long timeoutMs = -1;
+    if (position != -1 && position < userInput->argAmount) {
+        timeoutMs = parseDuration(userInput->args[position]);
+    }
+
+    // Show the default deadline.
+    *result = 0;
+    if (userInput->argAmount == 1) {
+        char message[64];
+        if (state->defaultTimeoutMs == 0) {
+            snprintf(message, sizeof(message), "timeout: none\n");
+        } else {
+            snprintf(message, sizeof(message), "timeout: %gs, kill after %gs\n", 
+                     state->defaultTimeoutMs / 1000.0, state->defaultKillAfterMs / 1000.0);
+        }
+        write(state->outFD, message, strlen(message));
+        return 0;
+    }
+    if (timeoutMs == -1) {
+        char* message = "timeout: usage: timeout [-k GRACE] DURATION [command]\n";
+        write(STDERR_FILENO, message, strlen(message));
+        *result = 125;
+        return 0;
+    }
+
+    // Set the default deadline.
+    if (position + 1 == userInput->argAmount) {
+        state->defaultTimeoutMs = timeoutMs;
+        if (killAfterMs != -1) {
+            state->defaultKillAfterMs = killAfterMs;
+        }
+        return 0;
+    }
+
+    // Drop "timeout" and it's options, the command is run with the deadline.
+    for (int i = 0; i <= position; i++) {
+        free(userInput->args[i]);
+    }
+    memmove(userInput->args, userInput->args + position + 1, (userInput->argAmount - position) * sizeof(char*));
+    userInput->argAmount -= position + 1;
+    userInput->timeoutMs = timeoutMs;
+    userInput->killAfterMs = killAfterMs;
+    return 1;
+}
+
+
+/*
+* place builtin. "place [--cpus LIST] [--node LIST] [--nice N] [--ioclass CLASS[:LEVEL]] cmd..."
+* runs cmd on the CPUs in LIST (i.e. "0-7,16"), with memory bound to the NUMA
+* nodes in LIST, it's nice value raised by N and it's I/O scheduling class 
+* set to realtime, best-effort or idle. "place --spread on" hands each later
+* background job the next of the shell's CPUs, "place --spread off" stops
+* that. Returns 1 with userInput cut down to cmd and it's placement set if 
+* cmd must be run, 0 with *result set otherwise.
+*/
+int placeCommand(struct shellState* state, struct input* userInput, int* result) {
+
+    *result = 0;
+    if (userInput->argAmount == 3 && strcmp(userInput->args[1], "--spread") == 0) {
+        if (strcmp(userInput->args[2], "on") == 0 || strcmp(userInput->args[2], "off") == 0) {
+            state->spreadJobs = (strcmp(userInput->args[2], "on") == 0);
+            state->spreadNext = 0;
+            return 0;
+        }
+    }
+
+    struct placement* placement = calloc(1, sizeof(struct placement));
+    int position = 1;
+    int error = 0;
+    while (error == 0 && position + 1 < userInput->argAmount && strncmp(userInput->args[position], "--", 2) == 0) {
+        char* option = userInput->args[position];
+        char* value = userInput->args[position + 1];
+        if (strcmp(option, "--cpus") == 0) {
+            error = parseIdList(value, &placement->cpus);
+            placement->hasCpus = 1;
+        } else if (strcmp(option, "--node") == 0) {
+            cpu_set_t nodeSet;
+            error = parseIdList(value, &nodeSet);
+            for (int node = 0; node < (int) (8 * sizeof(unsigned long)); node++) {
+                if (CPU_ISSET(node, &nodeSet)) {
+                    placement->nodes |= 1UL << node;
+                }
+            }
+            placement->hasNodes = 1;
+        } else if (strcmp(option, "--nice") == 0) {
+            char* end;
+            placement->niceIncrement = strtol(value, &end, 10);
+            error = (*end != '\0' || end == value) ? -1 : 0;
+            placement->hasNice = 1;
+        } else if (strcmp(option, "--ioclass") == 0) {
+            char* level = strchr(value, ':');
+            int ioLevel = (level != NULL) ? atoi(level + 1) : 4;
+            size_t classLen = (level != NULL) ? (size_t) (level - value) : strlen(value);
+            int ioClass = -1;
+            if (strncmp(value, "realtime", classLen) == 0 || strncmp(value, "rt", classLen) == 0) {
+                ioClass = IOPRIO_CLASS_RT;
+            } else if (strncmp(value, "best-effort", classLen) == 0 || strncmp(value, "be", classLen) == 0) {
+                ioClass = IOPRIO_CLASS_BE;
+            } else if (strncmp(value, "idle", classLen) == 0) {
+                ioClass = IOPRIO_CLASS_IDLE;
+                ioLevel = 0;
+            }
+            error = (ioClass == -1 || classLen == 0 || ioLevel < 0 || ioLevel > 7) ? -1 : 0;
+            placement->ioPriority = IOPRIO_PRIO_VALUE(ioClass, ioLevel);
+            placement->hasIoPriority = 1;
+        } else {
+            error = -1;
+        }
+        position += 2;
+    }
+
+    // Everything but the command must have been options.
+    if (error != 0 || position >= userInput->argAmount) {
+        char* message = "place: usage: place [--cpus LIST] [--node LIST] [--nice N] [--ioclass CLASS[:LEVEL]] command\n"
+                        "       place --spread on|off\n";
+        write(STDERR_FILENO, message, strlen(message));
+        free(placement);
+        *result = 1;
+        return 0;
+    }
+
+    // Drop "place" and it's options, the command is launched with the placement.
+    for (int i = 0; i < position; i++) {
+        free(userInput->args[i]);
+    }
+    memmove(userInput->args, userInput->args + position, (userInput->argAmount - position + 1) * sizeof(char*));
+    userInput->argAmount -= position;
+    free(userInput->placement);
+    userInput->placement = placement;
+    return 1;
+}
+
+
+/*
+* ulimit builtin. "ulimit [-v KiB] [-t SECONDS] [-n FILES] [-u PROCESSES] [-f KiB]"
+* sets limits every later child is launched with, "unlimited" lifting one.
+* Followed by a command the limits apply to that command alone. Plain 
+* "ulimit" shows the limits children get. The shell itself is never limited.
+* Returns 1 with userInput cut down to the command and it's limits set if
+* it must be run, 0 with *result set otherwise.
+*/
+int ulimitCommand(struct shellState* state, struct input* userInput, int* result) {
+
+    // Show the limits: the shell's defaults, else what children inherit.
+    *result = 0;
+    if (userInput->argAmount == 1) {
+        for (int i = 0; i < LIMIT_AMOUNT; i++) {
+            long value = state->defaultLimits[i];
+            if (value == LIMIT_UNSET) {
+                struct rlimit current;
+                getrlimit(limitResources[i].resource, &current);
+                value = (current.rlim_cur == RLIM_INFINITY) ? LIMIT_UNLIMITED : (long) (current.rlim_cur / limitResources[i].unit);
+            }
+            char message[96];
+            if (value == LIMIT_UNLIMITED) {
+                snprintf(message, sizeof(message), "%-22s(-%c) unlimited\n", limitResources[i].name, limitResources[i].option);
+            } else {
+                snprintf(message, sizeof(message), "%-22s(-%c) %ld\n", limitResources[i].name, limitResources[i].option, value);
+            }
+            write(state->outFD, message, strlen(message));
+        }
+        return 0;
+    }
+
+    // Options, each with a value.
+    long limits[LIMIT_AMOUNT];
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        limits[i] = LIMIT_UNSET;
+    }
+    int position = 1;
+    int error = 0;
+    while (error == 0 && position < userInput->argAmount && userInput->args[position][0] == '-') {
+        char* option = userInput->args[position];
+        char* value = userInput->args[position + 1];
+        int index = -1;
+        for (int i = 0; i < LIMIT_AMOUNT; i++) {
+            if (option[1] == limitResources[i].option && option[2] == '\0') {
+                index = i;
+            }
+        }
+        if (index == -1 || value == NULL) {
+            error = 1;
+            break;
+        }
+        char* end;
+        limits[index] = strtol(value, &end, 10);
+        if (strcmp(value, "unlimited") == 0) {
+            limits[index] = LIMIT_UNLIMITED;
+        } else if (end == value || *end != '\0' || limits[index] < 0) {
+            error = 1;
+        }
+        position += 2;
+    }
+    if (error != 0 || position == 1) {
+        char* message = "ulimit: usage: ulimit [-v KiB] [-t SECONDS] [-n FILES] [-u PROCESSES] [-f KiB] [command]\n";
+        write(STDERR_FILENO, message, strlen(message));
+        *result = 1;
+        return 0;
+    }
+
+    // Without a command the limits become the defaults.
+    long* target = (position == userInput->argAmount) ? state->defaultLimits : userInput->limits;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        if (limits[i] != LIMIT_UNSET) {
+            target[i] = limits[i];
+        }
+    }
+    if (target == state->defaultLimits) {
+        return 0;
+    }
+
+    // Drop "ulimit" and it's options, the command is launched with the limits.
+    for (int i = 0; i < position; i++) {
+        free(userInput->args[i]);
+    }
+    memmove(userInput->args, userInput->args + position, (userInput->argAmount - position + 1) * sizeof(char*));
+    userInput->argAmount -= position;
+    return 1;
+}
+
+
+/*
+* Write the pairs of envp to the state's output, sorted, each line starting 
+* with prefix.
+*/
+void writeEnvironment(struct shellState* state, char** envp, char* prefix) {
+
+    size_t amount = 0;
+    while (envp[amount] != NULL) {
+        amount++;
+    }
+    char** sorted = malloc((amount + 1) * sizeof(char*));
+    char** scratch = malloc((amount + 1) * sizeof(char*));
+    memcpy(sorted, envp, amount * sizeof(char*));
+    radixSortStrings(sorted, scratch, amount, 0);
+    for (size_t i = 0; i < amount; i++) {
+        write(state->outFD, prefix, strlen(prefix));
+        write(state->outFD, sorted[i], strlen(sorted[i]));
+        write(state->outFD, "\n", 1);
+    }
+    free(sorted);
+    free(scratch);
+    return;
+}
+
+
+/*
+* export builtin. "export NAME=value" sets and exports a variable, "export
+* NAME" exports one already set and plain "export" lists what children get.
+* Returns 1 if a name was not set or not valid.
+*/
+int exportCommand(struct shellState* state, struct input* userInput) {
+
+    if (userInput->argAmount == 1) {
+        writeEnvironment(state, currentEnvironment(state), "export ");
+        return 0;
+    }
+
+    int result = 0;
+    for (int i = 1; i < userInput->argAmount; i++) {
+        char* word = userInput->args[i];
+        char* equals = strchr(word, '=');
+        if (equals != NULL && isAssignment(word)) {
+            *equals = '\0';
+            setVariable(state, word, equals + 1);
+            exportVariable(state, word);
+            *equals = '=';
+        } else if (equals != NULL || exportVariable(state, word) == -1) {
+            char message[PATH_MAX + 32];
+            snprintf(message, sizeof(message), "export: %s: not set\n", word);
+            write(STDERR_FILENO, message, strlen(message));
+            result = 1;
+        }
+    }
+    return result;
+}
+
+
+/*
+* env builtin. "env [-i] [-u NAME]... [NAME=value]... cmd..." runs cmd with the
+* environment emptied (-i), NAME removed from it (-u) or NAME set, without 
+* touching the shell's variables. Without cmd the environment it would get
+* is listed. Returns 1 with userInput cut down to cmd and the changes added
+* to it's assignments if cmd must be run, 0 with *result set otherwise.
+*/
+int envCommand(struct shellState* state, struct input* userInput, int* result) {
+
+    *result = 0;
+    int position = 1;
+    while (position < userInput->argAmount) {
+        char* word = userInput->args[position];
+        if (strcmp(word, "-i") == 0 || strcmp(word, "-") == 0) {
+            userInput->clearEnvironment = 1;
+
+            // Assignments made in front of env are gone too.
+            for (int i = 0; i < userInput->assignmentAmount; i++) {
+                free(userInput->assignments[i]);
+            }
+            userInput->assignmentAmount = 0;
+            position++;
+        } else if (strcmp(word, "-u") == 0 && position + 1 < userInput->argAmount) {
+            addAssignment(userInput, userInput->args[position + 1]);
+            position += 2;
+        } else if (isAssignment(word)) {
+            addAssignment(userInput, word);
+            position++;
+        } else if (word[0] == '-') {
+            char* message = "env: usage: env [-i] [-u NAME]... [NAME=value]... [command]\n";
+            write(STDERR_FILENO, message, strlen(message));
+            *result = 125;
+            return 0;
+        } else {
+            break;
+        }
+    }
+
+    // List the environment.
+    if (position == userInput->argAmount) {
+        char** envp = commandEnvironment(state, userInput);
+        writeEnvironment(state, envp, "");
+        if (envp != state->envp) {
+            free(envp);
+        }
+        return 0;
+    }
+
+    // Drop "env" and it's options, the command is run with the assignments.
+    for (int i = 0; i < position; i++) {
+        free(userInput->args[i]);
+    }
+    memmove(userInput->args, userInput->args + position, (userInput->argAmount - position + 1) * sizeof(char*));
+    userInput->argAmount -= position;
+    return 1;
+}
+
+
+/*
+* stats builtin. "stats" shows the latency metrics as a table of counts and
+* percentiles, "stats --json" and "stats --prom" as JSON or Prometheus text.
+* "stats --save FILE" writes a snapshot to FILE when the shell exits (JSON
+* if it ends in ".json"). "stats on", "stats off" and "stats reset" start,
+* stop and clear the recording. Returns 1 for bad usage.
+*/
+int statsCommand(struct shellState* state, struct input* userInput) {
+
+    char* option = (userInput->argAmount > 1) ? userInput->args[1] : NULL;
+    if (option == NULL) {
+        writeStats(state, state->outFD, STATS_TABLE);
+    } else if (strcmp(option, "--json") == 0) {
+        writeStats(state, state->outFD, STATS_JSON);
+    } else if (strcmp(option, "--prom") == 0) {
+        writeStats(state, state->outFD, STATS_PROMETHEUS);
+    } else if (strcmp(option, "--save") == 0 && userInput->argAmount == 3 && strlen(userInput->args[2]) < PATH_MAX) {
+        strcpy(state->statsFile, userInput->args[2]);
+    } else if (strcmp(option, "on") == 0) {
+        state->statsEnabled = 1;
+    } else if (strcmp(option, "off") == 0) {
+        state->statsEnabled = 0;
+    } else if (strcmp(option, "reset") == 0) {
+        resetStats(state);
+    } else {
+        char* message = "stats: usage: stats [--json | --prom | --save FILE | on | off | reset]\n";
+        write(STDERR_FILENO, message, strlen(message));
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+* Split the data of array into lines with memchr(), which scans a vector 
+* register of bytes at a time, keeping only their offsets. The first skip
+* lines are dropped and at most count kept (-1 for all).
+*/
+void splitLines(struct lineArray* array, long skip, long count) {
+
+    size_t capacity = 1024;
+    array->starts = malloc(capacity * sizeof(size_t));
+    array->lineAmount = 0;
+    size_t position = 0;
+    while (position < array->length && (count < 0 || array->lineAmount < (size_t) count)) {
+        char* newline = memchr(array->data + position, '\n', array->length - position);
+        size_t end = (newline != NULL) ? (size_t) (newline - array->data) : array->length;
+        if (skip > 0) {
+            skip--;
+        } else {
+            if (array->lineAmount + 2 > capacity) {
+                capacity *= 2;
+                array->starts = realloc(array->starts, capacity * sizeof(size_t));
+            }
+            array->starts[array->lineAmount++] = position;
+        }
+        position = end + 1;
+    }
+
+    // One past the newline of the last line kept, it's end.
+    array->starts[array->lineAmount] = position;
+    return;
+}
+
+
+/*
+* Load the lines of fd into array. A regular file is mapped whole with 
+* mmap(), prefaulted, anything else read in chunks that double in size 
+* into one buffer. Returns -1 with errno set.
+*/
+int loadLines(struct shellState* state, struct lineArray* array, int fd) {
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0) {
+        void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            array->data = mapping;
+            array->length = fileStat.st_size;
+            array->mapped = 1;
+            return 0;
+        }
+    }
+
+    size_t capacity = 1 << 20;
+    array->data = malloc(capacity);
+    array->length = 0;
+    while (state->interrupted == 0) {
+        if (array->length == capacity) {
+            capacity *= 2;
+            array->data = realloc(array->data, capacity);
+        }
+        ssize_t readLen = read(fd, array->data + array->length, capacity - array->length);
+        if (readLen == -1 && errno == EINTR) {
+            continue;
+        }
+        if (readLen == -1) {
+            return -1;
+        }
+        if (readLen == 0) {
+            break;
+        }
+        array->length += readLen;
+    }
+    return 0;
+}
+
+
+/*
+* Is word a valid variable name?
+*/
+int isName(char* word) {
+
+    if (word[0] != '_' && !isalpha((unsigned char) word[0])) {
+        return 0;
+    }
+    for (int i = 1; word[i] != '\0'; i++) {
+        if (word[i] != '_' && !isalnum((unsigned char) word[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+* mapfile builtin, also called readlines. "mapfile [-t] [-n COUNT] [-s SKIP]
+* [NAME] [FILE]" loads the lines of FILE, or of stdin ("mapfile NAME < 
+* FILE"), into the array NAME (MAPFILE if not given),
+* replacing what it held. Lines are kept as offsets into the mapped file 
+* and used by "${NAME[@]}", "${NAME[N]}" and "${#NAME[@]}". Newlines are 
+* always dropped, -t is accepted for scripts written for bash. Returns 1 
+* for bad usage or a file that could not be read.
+*/
+int mapfileCommand(struct shellState* state, struct input* userInput) {
+
+    int inFD, outFD;
+    if (openRedirections(state, userInput, &inFD, &outFD) == -1) {
+        return 1;
+    }
+    closeRedirections(state, userInput, STDIN_FILENO, outFD);
+
+    long skip = 0;
+    long count = -1;
+    char* name = "MAPFILE";
+    char* file = NULL;
+    int usage = 0;
+    int positional = 0;
+    for (int i = 1; i < userInput->argAmount; i++) {
+        char* arg = userInput->args[i];
+        char* end;
+        if (strcmp(arg, "-t") == 0) {
+            continue;
+        } else if ((strcmp(arg, "-n") == 0 || strcmp(arg, "-s") == 0) && i + 1 < userInput->argAmount) {
+            long number = strtol(userInput->args[i+1], &end, 10);
+            usage = usage || (*end != '\0' || number < 0);
+            *((arg[1] == 'n') ? &count : &skip) = number;
+            i++;
+        } else if (positional == 0 && isName(arg)) {
+            name = arg;
+            positional++;
+        } else if (file == NULL && arg[0] != '-') {
+            file = arg;
+            positional++;
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage) {
+        char* message = "mapfile: usage: mapfile [-t] [-n COUNT] [-s SKIP] [NAME] [FILE]\n";
+        write(STDERR_FILENO, message, strlen(message));
+        if (inFD != STDIN_FILENO) {
+            close(inFD);
+        }
+        return 1;
+    }
+
+    int fd = (file != NULL) ? open(file, O_RDONLY | O_CLOEXEC) : inFD;
+    struct lineArray* array = calloc(1, sizeof(struct lineArray));
+    if (fd == -1 || loadLines(state, array, fd) == -1) {
+        char message[PATH_MAX + 16];
+        snprintf(message, sizeof(message), "mapfile: %s", (file != NULL) ? file : "stdin");
+        perror(message);
+        free(array->data);
+        free(array);
+        if (fd != -1 && fd != inFD) {
+            close(fd);
+        }
+        if (inFD != STDIN_FILENO) {
+            close(inFD);
+        }
+        return 1;
+    }
+    if (fd != inFD) {
+        close(fd);
+    }
+    if (inFD != STDIN_FILENO) {
+        close(inFD);
+    }
+    splitLines(array, skip, count);
+
+    // Replace the array of the same name.
+    removeLineArray(state, name);
+    array->name = malloc(strlen(name) + 1);
+    strcpy(array->name, name);
+    unsigned int bucket = (unsigned int) hash(name) % LINE_ARRAY_BUCKETS;
+    array->next = state->lineArrays[bucket];
+    state->lineArrays[bucket] = array;
+    return 0;
+}
+
+
+/*
+* Run the output only builtins status, export and stats with their output 
+* sent to any ">" target, the way a child's would be. Returns the builtin's
+* result.
+*/
+int redirectBuiltin(struct shellState* state, struct input* userInput) {
+
+    int inFD, outFD;
+    if (openRedirections(state, userInput, &inFD, &outFD) == -1) {
+        return 1;
+    }
+    int savedOutFD = state->outFD;
+    state->outFD = outFD;
+
+    int result = 0;
+    if (strcmp(userInput->args[0], "status") == 0) {
+        status(state);
+    } else if (strcmp(userInput->args[0], "stats") == 0) {
+        result = statsCommand(state, userInput);
+    } else {
+        result = exportCommand(state, userInput);
+    }
+
+    state->outFD = savedOutFD;
+    closeRedirections(state, userInput, inFD, outFD);
+    return result;
+}
+
+
+/*
+* Open, copy or close the descriptor named by an exec word: "N>file", 
+* "N>>file" (append), "N<file", "N>&M" or "N>&-", where a file name left
+* out is taken from next. Sets *usedNext if it was. Returns -1 after 
+* printing an error, 0 if word does not start with a descriptor number.
+*/
+int execRedirection(struct shellState* state, char* word, char* next, int* usedNext) {
+
+    *usedNext = 0;
+    if (!isdigit((unsigned char) word[0]) || (word[1] != '>' && word[1] != '<')) {
+        return 0;
+    }
+    int n = word[0] - '0';
+    char message[PATH_MAX + 64];
+    if (n < 3) {
+        snprintf(message, sizeof(message), "exec: %d: only descriptors 3-9 can be opened\n", n);
+        write(STDERR_FILENO, message, strlen(message));
+        return -1;
+    }
+
+    // Copy or close.
+    int fd = -1;
+    int target, source;
+    if (parseDupRedirection(word, &target, &source)) {
+        if (source != -1) {
+            int sourceFD = shellFD(state, source);
+            fd = (sourceFD == -1) ? -1 : fcntl(sourceFD, F_DUPFD_CLOEXEC, USER_FD_AMOUNT);
+            if (fd == -1) {
+                snprintf(message, sizeof(message), "exec: %d: bad file descriptor\n", source);
+                write(STDERR_FILENO, message, strlen(message));
+                return -1;
+            }
+        }
+    } else {
+
+        // Open, the file name may follow as the next word.
+        int flags = O_RDONLY;
+        char* path = word + 2;
+        if (word[1] == '>' && word[2] == '>') {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            path = word + 3;
+        } else if (word[1] == '>') {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        if (*path == '\0' && next != NULL) {
+            path = next;
+            *usedNext = 1;
+        }
+        int openedFD = open(path, flags | O_CLOEXEC, 0660);
+        if (openedFD == -1) {
+            snprintf(message, sizeof(message), "exec: %s", path);
+            perror(message);
+            return -1;
+        }
+
+        // Keep it clear of the descriptors commands are handed.
+        fd = fcntl(openedFD, F_DUPFD_CLOEXEC, USER_FD_AMOUNT);
+        close(openedFD);
+    }
+
+    if (state->userFDs[n] != -1) {
+        close(state->userFDs[n]);
+    }
+    state->userFDs[n] = fd;
+    return 1;
+}
+
+
+/*
+* exec builtin. "exec 3>file", "exec 3>>file", "exec 4<file", "exec 5>&3" and
+* "exec 3>&-" keep descriptors 3-9 open (or close them) in the shell for
+* later commands to use with ">&3", so writing a log line after line costs a
+* dup2() instead of an open(). "exec cmd" replaces the shell with cmd. 
+* Returns 1 if a descriptor could not be opened, 127 if cmd was not found.
+*/
+int execBuiltin(struct shellState* state, struct input* userInput) {
+
+    // Only descriptor redirections: apply them all, stopping at an error.
+    int usedNext = 0;
+    int result = (userInput->argAmount == 1) ? 1 : execRedirection(state, userInput->args[1], userInput->args[2], &usedNext);
+    if (result != 0) {
+        for (int i = 2 + usedNext; result == 1 && i < userInput->argAmount; i += 1 + usedNext) {
+            result = execRedirection(state, userInput->args[i], userInput->args[i+1], &usedNext);
+            if (result == 0) {
+                char message[PATH_MAX + 64];
+                snprintf(message, sizeof(message), "exec: %s: not a descriptor redirection\n", userInput->args[i]);
+                write(STDERR_FILENO, message, strlen(message));
+            }
+        }
+        return (result == 1) ? 0 : 1;
+    }
+
+    // Replace the shell with the command, if there is one to replace it with.
+    free(userInput->args[0]);
+    memmove(userInput->args, userInput->args + 1, userInput->argAmount * sizeof(char*));
+    userInput->argAmount--;
+    char* pathVar = assignedPath(userInput);
+    char* searched = (pathVar != NULL) ? searchPath(pathVar, userInput->args[0]) : NULL;
+    int found = (pathVar != NULL) ? (searched != NULL) : (resolveCommand(state, userInput->args[0]) != NULL);
+    free(searched);
+    if (strchr(userInput->args[0], '/') == NULL && found == 0) {
+        char message[PATH_MAX + 32];
+        snprintf(message, sizeof(message), "exec: %s: not found\n", userInput->args[0]);
+        write(STDERR_FILENO, message, strlen(message));
+        return 127;
+    }
+    userInput = ioRedirection(state, userInput);
+    for (int i = 0; i < userInput->procSubAmount; i++) {
+        fcntl(userInput->procSubFds[i], F_SETFD, 0);
+    }
+    execCommand(state, userInput);
+    perror(userInput->args[0]);
+    exit(126);
+}
+
+
+/*
+* Run the command left once a prefix builtin (timeout, place, ulimit, env) 
+* took it's options. Further prefixes are dispatched again, anything else is exec'd.
+*/
+int runPrefixed(struct shellState* state, struct input* userInput) {
+
+    if (strcmp(userInput->args[0], "timeout") == 0 || strcmp(userInput->args[0], "place") == 0 ||
+        strcmp(userInput->args[0], "ulimit") == 0 || strcmp(userInput->args[0], "env") == 0) {
+        return runInput(state, userInput);
+    }
+    return runExternal(state, userInput);
+}
+
+
+/*
+* Return a copy of userInput that can be run on it's own. Running an input
+* consumes it, prefix builtins and redirections rewrite the args.
+*/
+struct input* copyInput(struct input* userInput) {
+
+    struct input* copy = createInput(userInput->buffer, strlen(userInput->buffer));
+    for (int i = 0; i < userInput->argAmount; i++) {
+        addArg(copy, userInput->args[i]);
+    }
+    for (int i = 0; i < userInput->assignmentAmount; i++) {
+        addAssignment(copy, userInput->assignments[i]);
+    }
+    copy->clearEnvironment = userInput->clearEnvironment;
+    copy->timeoutMs = userInput->timeoutMs;
+    copy->killAfterMs = userInput->killAfterMs;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        copy->limits[i] = userInput->limits[i];
+    }
+    if (userInput->placement != NULL) {
+        copy->placement = malloc(sizeof(struct placement));
+        memcpy(copy->placement, userInput->placement, sizeof(struct placement));
+    }
+    return copy;
+}
+
+
+/*
+* every builtin. "every [--diff] [--queue] [-n COUNT] INTERVAL cmd..." runs cmd
+* each INTERVAL (i.e. "250ms" or "5s") until "^C", or COUNT times. The ticks
+* come from a periodic timerfd, so the schedule does not drift with the time
+* cmd takes and no sleep process runs between them. cmd is expanded once and
+* run like any other command, builtins in process. Ticks that pass while cmd
+* is still running are skipped, or made up back to back with --queue. With 
+* --diff the output of a run is only shown if it differs from the run before.
+* "watch INTERVAL cmd..." is "every --diff". Returns the exit value of the 
+* last run, 2 for bad usage.
+*/
+int everyCommand(struct shellState* state, struct input* userInput) {
+
+    // Options and the interval.
+    int diff = (strcmp(userInput->args[0], "watch") == 0);
+    int queue = 0;
+    long count = -1;
+    int position = 1;
+    while (position < userInput->argAmount && userInput->args[position][0] == '-') {
+        if (strcmp(userInput->args[position], "--diff") == 0) {
+            diff = 1;
+        } else if (strcmp(userInput->args[position], "--queue") == 0) {
+            queue = 1;
+        } else if (strcmp(userInput->args[position], "-n") == 0 && position + 1 < userInput->argAmount) {
+            position++;
+            count = strtol(userInput->args[position], NULL, 10);
+        } else {
+            break;
+        }
+        position++;
+    }
+    long intervalMs = (position < userInput->argAmount) ? parseDuration(userInput->args[position]) : -1;
+    if (intervalMs <= 0 || count == 0 || position + 1 >= userInput->argAmount) {
+        char* message = "every: usage: every [--diff] [--queue] [-n COUNT] INTERVAL command\n";
+        write(STDERR_FILENO, message, strlen(message));
+        return 2;
+    }
+
+    // Drop "every" and it's options, the rest is run each tick.
+    for (int i = 0; i <= position; i++) {
+        free(userInput->args[i]);
+    }
+    memmove(userInput->args, userInput->args + position + 1, (userInput->argAmount - position) * sizeof(char*));
+    userInput->argAmount -= position + 1;
+    userInput->bgFlag = 0;
+
+    // The first tick is right away, the timer then repeats on it's own.
+    int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timerFD == -1) {
+        perror("every: timerfd_create()");
+        return 1;
+    }
+    struct itimerspec schedule = {0};
+    schedule.it_interval.tv_sec = intervalMs / 1000;
+    schedule.it_interval.tv_nsec = (intervalMs % 1000) * 1000000;
+    schedule.it_value.tv_nsec = 1;
+    timerfd_settime(timerFD, 0, &schedule, NULL);
+
+    // With --diff each run writes into a memory file compared with the last.
+    int savedOutFD = state->outFD;
+    int memFD = -1;
+    struct captureBuffer last = { NULL, 0, 0 };
+    if (diff) {
+        memFD = memfd_create("smallsh-every", MFD_CLOEXEC);
+        if (memFD == -1) {
+            perror("every: memfd_create()");
+            close(timerFD);
+            return 1;
+        }
+    }
+
+    int result = 0;
+    long runs = 0;
+    uint64_t pending = 0;
+    struct pollfd pollFD = { timerFD, POLLIN, 0 };
+    while ((count < 0 || runs < count) && state->interrupted == 0 && state->exitRequested == 0) {
+
+        /* Sleep in poll() rather than read(), which SA_RESTART would resume
+        after "^C". */
+        if (pending == 0) {
+            uint64_t expirations;
+            if (poll(&pollFD, 1, -1) == -1 || read(timerFD, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                continue;
+            }
+            pending = queue ? expirations : 1;
+        }
+        pending--;
+
+        if (diff) {
+            ftruncate(memFD, 0);
+            lseek(memFD, 0, SEEK_SET);
+            state->outFD = memFD;
+        }
+        struct input* run = copyInput(userInput);
+        result = runInput(state, run);
+        freeUserInput(run);
+        runs++;
+
+        // Show the output only when it changed.
+        if (diff) {
+            state->outFD = savedOutFD;
+            struct captureBuffer current = { NULL, 0, 0 };
+            lseek(memFD, 0, SEEK_SET);
+            readAllFD(memFD, &current);
+            if (last.data == NULL || current.length != last.length || memcmp(current.data, last.data, current.length) != 0) {
+                for (size_t written = 0; written < current.length; ) {
+                    ssize_t amount = write(state->outFD, current.data + written, current.length - written);
+                    if (amount == -1 && errno != EINTR) {
+                        break;
+                    }
+                    written += (amount > 0) ? amount : 0;
+                }
+            }
+            free(last.data);
+            last = current;
+        }
+    }
+    free(last.data);
+    if (memFD != -1) {
+        close(memFD);
+    }
+    close(timerFD);
+    return result;
+}
+
+
+/*
+* Return the hash of name if it is a builtin, -1 if it is any other command.
+* Builtins are dispatched by hash, checking the name as well keeps commands
+* whose names only hash the same (such as "dc" and "cd") from being taken 
+* for builtins.
+*/
+int builtinHash(char* name) {
+
+    // Linefeed (blank line) and builtin names.
+    char* builtins[] = { "\n", "cd", "exit", "status", "true", "false", "break", "continue", "cat", "timeout", "place", "ulimit", "export", "unset", "env", "exec", "every", "watch", "stats", "alias", "unalias", "mapfile", "readlines", NULL };
+    for (int i = 0; builtins[i] != NULL; i++) {
+        if (strcmp(name, builtins[i]) == 0) {
+            return hash(name);
+        }
+    }
+    return -1;
+}
+
+
+/*
+* Run an expanded input. Builtins are directed to the functions that handle
+* them in process, any other command is forked and exec'd. Returns the exit
+* value used by "&&" and "||": the builtin's result, the foreground child's 
+* exit value, or 0 for a background child.
+*/
+int runInput(struct shellState* state, struct input* userInput) {
+
+    int result = 0;
+
+    // Shell messages come before anything the command writes.
+    outputFlush(&state->output);
+
+    /* Determine which command was entered and deligate
+    to the appropriate function for handling. */
+    switch (builtinHash(userInput->args[0])) {
+
+        // Hash for linefeed, assignments without a command set shell variables.
+        case 11:
+            for (int i = 0; i < userInput->assignmentAmount; i++) {
+                char* equals = strchr(userInput->assignments[i], '=');
+                *equals = '\0';
+                setVariable(state, userInput->assignments[i], equals + 1);
+                *equals = '=';
+            }
+            break;
+
+        // Hash for cd = 202
+        case 202:
+            result = cd(state, userInput);
+            break;
+
+        // Hash for exit = 452, the program driving the state does the exit.
+        case 452:
+            state->exitRequested = 1;
+            state->exitCode = state->lastCode;
+            if (userInput->argAmount > 1) {
+                char* end;
+                long code = strtol(userInput->args[1], &end, 10);
+                if (*end != '\0' || end == userInput->args[1]) {
+                    char message[PATH_MAX + 48];
+                    snprintf(message, sizeof(message), "exit: %s: numeric argument required\n", userInput->args[1]);
+                    write(STDERR_FILENO, message, strlen(message));
+                    code = 2;
+                }
+                state->exitCode = (int) (code & 0xff);
+            }
+            result = state->exitCode;
+            break;
+
+        // Hash for status = 697
+        case 697:
+            result = redirectBuiltin(state, userInput);
+            break;
+
+        // Hash for true = 458
+        case 458:
+            break;
+
+        // Hash for false = 538
+        case 538:
+            result = 1;
+            break;
+
+        /* Hash for break and place = 532. A break is taken by the innermost
+        loop if there is one. */
+        case 532:
+            if (strcmp(userInput->args[0], "place") == 0) {
+                if (placeCommand(state, userInput, &result) == 1) {
+                    result = runPrefixed(state, userInput);
+                }
+            } else if (state->loopDepth > 0) {
+                state->loopControl = LOOP_BREAK;
+            }
+            break;
+
+        // Hash for continue = 905
+        case 905:
+            if (state->loopDepth > 0) {
+                state->loopControl = LOOP_CONTINUE;
+            }
+            break;
+
+        // Hash for cat = 318, only foreground cats run in process.
+        case 318:
+            if (userInput->bgFlag == 0 && catOptions(userInput) == 0) {
+                result = catFiles(state, userInput);
+            } else {
+                result = runExternal(state, userInput);
+            }
+            break;
+
+        // Hash for ulimit = 681
+        case 681:
+            if (ulimitCommand(state, userInput, &result) == 1) {
+                result = runPrefixed(state, userInput);
+            }
+            break;
+
+        // Hash for every = 570, watch = 550
+        case 570:
+        case 550:
+            result = everyCommand(state, userInput);
+            break;
+
+        // Hash for exec = 431
+        case 431:
+            result = execBuiltin(state, userInput);
+            break;
+
+        // Hash for export = 695
+        case 695:
+            result = redirectBuiltin(state, userInput);
+            break;
+
+        // Hash for unset and stats = 574
+        case 574:
+            if (strcmp(userInput->args[0], "stats") == 0) {
+                result = redirectBuiltin(state, userInput);
+                break;
+            }
+            if (userInput->argAmount > 1 && strcmp(userInput->args[1], "-f") == 0) {
+                for (int i = 2; i < userInput->argAmount; i++) {
+                    removeDefinition(state, userInput->args[i], DEFINITION_FUNCTION);
+                }
+                break;
+            }
+            for (int i = 1; i < userInput->argAmount; i++) {
+                unsetVariable(state, userInput->args[i]);
+                removeLineArray(state, userInput->args[i]);
+            }
+            break;
+
+        // Hash for mapfile = 762 and readlines = 996
+        case 762:
+        case 996:
+            result = mapfileCommand(state, userInput);
+            break;
+
+        // Hash for alias = 537
+        case 537:
+            result = aliasCommand(state, userInput);
+            break;
+
+        // Hash for unalias = 777
+        case 777:
+            for (int i = 1; i < userInput->argAmount; i++) {
+                if (removeDefinition(state, userInput->args[i], DEFINITION_ALIAS) == 0) {
+                    result = 1;
+                }
+            }
+            break;
+
+        // Hash for env = 335
+        case 335:
+            if (envCommand(state, userInput, &result) == 1) {
+                result = runPrefixed(state, userInput);
+            }
+            break;
+
+        // Hash for timeout = 803
+        case 803:
+            if (timeoutCommand(state, userInput, &result) == 1) {
+                result = runPrefixed(state, userInput);
+            }
+            break;
+        
+        // Handle any other command using exec.
+        default:
+            result = runExternal(state, userInput);
+    }
+    return result;
+}
+
+
+/*
+* Should the commands left in the current list be skipped? True after "exit",
+* "^C", or a "break" or "continue" that a loop has yet to take.
+*/
+int stopRunning(struct shellState* state) {
+
+    return state->exitRequested != 0 || state->interrupted != 0 || state->loopControl != 0;
+}
+
+
+/*
+* Run a function with the arguments of userInput as "$1", "$2"... in the
+* shell itself. The body was parsed when the function was defined, only 
+* it's words that are not literal get expanded. Redirections apply to the
+* whole body and "&" runs it in a forked copy of the shell. Returns the exit
+* value of the last command it ran, 0 if it went to the background.
+*/
+int callFunction(struct shellState* state, struct shellDefinition* function, struct input* userInput) {
+
+    if (state->functionDepth >= FUNCTION_DEPTH_MAX) {
+        char message[PATH_MAX + 64];
+        snprintf(message, sizeof(message), "%s: functions nested too deeply\n", function->name);
+        write(STDERR_FILENO, message, strlen(message));
+        return 1;
+    }
+
+    // The child runs the body in the foreground of it's own.
+    if (userInput->bgFlag == 1) {
+        pid_t spawnPid = forkBackground(state, function->name);
+        if (spawnPid != 0) {
+            return (spawnPid == -1) ? 1 : 0;
+        }
+        userInput->bgFlag = 0;
+        exit(callFunction(state, function, userInput));
+    }
+
+    /* Output goes to state->outFD as for builtins, so commands of the body
+    write to the ">" target. "<" is put on the shell's stdin while the body 
+    runs, the shell does not read it's own input meanwhile. */
+    int inFD, outFD;
+    if (openRedirections(state, userInput, &inFD, &outFD) == -1) {
+        return 1;
+    }
+    int savedOutFD = state->outFD;
+    state->outFD = outFD;
+    int savedStdin = -1;
+    if (inFD != STDIN_FILENO) {
+        savedStdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(inFD, STDIN_FILENO);
+    }
+
+    char** savedPositional = state->positional;
+    int savedPositionalAmount = state->positionalAmount;
+    state->positional = userInput->args + 1;
+    state->positionalAmount = userInput->argAmount - 1;
+    state->functionDepth++;
+    function->running++;
+
+    int result = runNode(state, function->body);
+
+    function->running--;
+    state->functionDepth--;
+    state->positional = savedPositional;
+    state->positionalAmount = savedPositionalAmount;
+    if (function->removed && function->running == 0) {
+        releaseDefinition(function);
+    }
+
+    if (inFD != STDIN_FILENO) {
+        if (savedStdin != -1) {
+            dup2(savedStdin, STDIN_FILENO);
+            close(savedStdin);
+        } else {
+            close(STDIN_FILENO);
+        }
+    }
+    state->outFD = savedOutFD;
+    closeRedirections(state, userInput, inFD, outFD);
+    return result;
+}
+
+
+/*
+* Run a loop body once for a NODE_WHILE, NODE_UNTIL or NODE_FOR node and take
+* any "break" or "continue" it ran. Returns 0 once the loop must end.
+*/
+int runLoopBody(struct shellState* state, struct commandNode* node, int* result) {
+
+    *result = runNode(state, node->right);
+    int control = state->loopControl;
+    state->loopControl = 0;
+    return control != LOOP_BREAK && state->exitRequested == 0 && state->interrupted == 0;
+}
+
+
+/*
+* Run a "for NAME in ${ARRAY[@]}" loop over the lines of a mapfile array
+* where they are, each copied into one reused buffer to set NAME instead 
+* of expanding all of them into arguments first. Returns the exit value
+* of the body.
+*/
+int forLines(struct shellState* state, struct commandNode* node, struct lineArray* lines) {
+
+    int result = 0;
+    size_t capacity = 256;
+    char* buffer = malloc(capacity);
+    lines->running++;
+    state->loopDepth++;
+    for (size_t l = 0; l < lines->lineAmount && lines->removed == 0 && stopRunning(state) == 0; l++) {
+        size_t lineLen;
+        char* line = lineAt(lines, l, &lineLen);
+        if (lineLen + 1 > capacity) {
+            capacity = (lineLen + 1) * 2;
+            buffer = realloc(buffer, capacity);
+        }
+        memcpy(buffer, line, lineLen);
+        buffer[lineLen] = '\0';
+        setVariable(state, node->words[0], buffer);
+        if (runLoopBody(state, node, &result) == 0) {
+            break;
+        }
+    }
+    state->loopDepth--;
+    lines->running--;
+    if (lines->removed && lines->running == 0) {
+        releaseLineArray(lines);
+    }
+    free(buffer);
+    return result;
+}
+
+
+/*
+* Fork a background job that runs in the shell's image rather than exec'ing,
+* for groups, compound commands and functions followed by "&". The child 
+* gets a process group of it's own so "^C" and "^Z" at the terminal do not
+* reach the commands it runs in the foreground, and /dev/null as stdin. The
+* parent tracks it in bgList under name and reports it's pid. Returns 0 in
+* the child, the child's pid in the parent and -1 if fork() failed.
+*/
+pid_t forkBackground(struct shellState* state, char* name) {
+
+    int64_t forked = smallshClock(state);
+    pid_t spawnPid = fork();
+    if (spawnPid == -1) {
+        perror("fork() failed!");
+        return -1;
+    }
+    if (spawnPid == 0) {
+        setpgid(0, 0);
+        struct sigaction ignoreAction = {0};
+        ignoreAction.sa_handler = SIG_IGN;
+        sigaction(SIGINT, &ignoreAction, NULL);
+        sigaction(SIGTSTP, &ignoreAction, NULL);
+        int nullFD = open("/dev/null", O_RDONLY);
+        if (nullFD != -1) {
+            dup2(nullFD, STDIN_FILENO);
+            close(nullFD);
+        }
+
+        // Messages waiting in the parent's buffer are the parent's to write.
+        outputInit(&state->output, state->output.fd);
+        state->tailCommand = NULL;
+        return 0;
+    }
+    setpgid(spawnPid, spawnPid);
+    createNode(state->bgList, spawnPid);
+    state->bgList->tail->started = forked;
+    state->bgList->tail->stats = commandStats(state, name);
+    outputConstant(&state->output, "background pid is ");
+    outputNumber(&state->output, spawnPid);
+    outputConstant(&state->output, "\n");
+    return spawnPid;
+}
+
+
+/*
+* Evaluate a command tree in the shell. Lists, "&&", "||", groups and control
+* flow are handled here without forking, only simple commands that actually
+* run are expanded and, unless they are builtins, forked. Returns the exit value of
+* the last command run.
+*/
+int runNode(struct shellState* state, struct commandNode* node) {
+
+    int result = 0;
+    if (node == NULL) {
+        return result;
+    }
+
+    /* A group or compound command followed by "&" runs whole in a child,
+    unless "&" is being ignored. Simple commands handle it themselves. */
+    if (node->type != NODE_COMMAND && node->background == 1 && state->bgIgnore == 0 && state->foregroundOnly == 0) {
+        pid_t spawnPid = forkBackground(state, (node->type == NODE_GROUP) ? "{" : "compound");
+        if (spawnPid == 0) {
+            node->background = 0;
+            exit(runNode(state, node));
+        }
+        state->lastCode = (spawnPid == -1) ? 1 : 0;
+        return state->lastCode;
+    }
+
+    switch (node->type) {
+        /* Aliases are replaced by the words they stand for, functions are
+        looked up before the builtins. */
+        case NODE_COMMAND:
+            ;
+            struct commandNode* aliased = expandAlias(state, node);
+            struct input* userInput = expandCommand(state, (aliased != NULL) ? aliased : node);
+            userInput->tailExec = (node == state->tailCommand);
+            struct shellDefinition* function = findDefinition(state, userInput->args[0], DEFINITION_FUNCTION);
+            if (function != NULL) {
+                result = callFunction(state, function, userInput);
+            } else {
+                result = runInput(state, userInput);
+            }
+            freeUserInput(userInput);
+            if (aliased != NULL) {
+                freeAliasNode(aliased);
+            }
+            break;
+
+        // Keep a copy of the body, the tree is freed after the line ran.
+        case NODE_FUNCTION:
+            addDefinition(state, node->words[0], DEFINITION_FUNCTION, copyCommandNode(node->left));
+            break;
+
+        // Stop early once "exit", "^C", "break" or "continue" ran.
+        case NODE_LIST:
+            for (int i = 0; i < node->childAmount && stopRunning(state) == 0; i++) {
+                result = runNode(state, node->children[i]);
+            }
+            break;
+
+        case NODE_AND:
+            result = runNode(state, node->left);
+            if (result == 0 && stopRunning(state) == 0) {
+                result = runNode(state, node->right);
+            }
+            break;
+
+        case NODE_OR:
+            result = runNode(state, node->left);
+            if (result != 0 && stopRunning(state) == 0) {
+                result = runNode(state, node->right);
+            }
+            break;
+
+        case NODE_GROUP:
+            result = runNode(state, node->left);
+            break;
+
+        // Run the body of the first condition that succeeds, else the "else" body.
+        case NODE_IF:
+            for (int i = 0; i < node->childAmount && stopRunning(state) == 0; i += 2) {
+                if (i + 1 == node->childAmount) {
+                    result = runNode(state, node->children[i]);
+                } else if (runNode(state, node->children[i]) == 0) {
+                    if (stopRunning(state) == 0) {
+                        result = runNode(state, node->children[i+1]);
+                    }
+                    break;
+                }
+            }
+            break;
+
+        /* The condition and body trees are reused each iteration, only the 
+        words that are not literal get expanded again. */
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            state->loopDepth++;
+            while (stopRunning(state) == 0) {
+                int condition = runNode(state, node->left);
+                if (stopRunning(state) != 0 || (condition == 0) != (node->type == NODE_WHILE) ||
+                    runLoopBody(state, node, &result) == 0) {
+                    break;
+                }
+            }
+            state->loopDepth--;
+            break;
+
+        // The word list is expanded once, before the first iteration.
+        case NODE_FOR:
+            ;
+            struct lineArray* lines = (node->wordAmount == 2) ? wholeArray(state, node->words[1]) : NULL;
+            if (lines != NULL) {
+                result = forLines(state, node, lines);
+                break;
+            }
+            struct input* items = expandCommand(state, node);
+            state->loopDepth++;
+            for (int i = 1; i < items->argAmount && stopRunning(state) == 0; i++) {
+                setVariable(state, node->words[0], items->args[i]);
+                if (runLoopBody(state, node, &result) == 0) {
+                    break;
+                }
+            }
+            state->loopDepth--;
+            freeUserInput(items);
+            break;
+    }
+
+    // "$?" holds the exit value of whatever ran last, loops and ifs included.
+    state->lastCode = result;
+    return result;
+}
+
+
+/*
+* Return the command of a tree that nothing runs after, or NULL if the 
+* tree ends in a background command, a loop or an if. The right side of
+* "&&" and "||" counts since the line ends whether or not it runs.
+*/
+struct commandNode* tailCommand(struct commandNode* node) {
+
+    while (node != NULL) {
+        switch (node->type) {
+            case NODE_COMMAND:
+                return (node->background == 0) ? node : NULL;
+            case NODE_LIST:
+                node = (node->childAmount > 0) ? node->children[node->childAmount - 1] : NULL;
+                break;
+            case NODE_AND:
+            case NODE_OR:
+                node = node->right;
+                break;
+            case NODE_GROUP:
+                node = node->left;
+                break;
+            default:
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+* Return the simple command a tree consists of, or NULL if it is anything
+* more than one foreground simple command.
+*/
+struct commandNode* singleCommand(struct commandNode* tree) {
+
+    if (tree != NULL && tree->type == NODE_LIST && tree->childAmount == 1 &&
+        tree->children[0]->type == NODE_COMMAND && tree->children[0]->background == 0) {
+        return tree->children[0];
+    }
+    return NULL;
+}
+
+
+/*
+* Run a command tree in the current (child) process and exit with it's exit
+* value. A lone external command is exec'd in place instead of forked again.
+* Used by the children of substitutions and of the server. Never returns.
+*/
+void execNodeInChild(struct shellState* state, struct commandNode* tree) {
+
+    struct commandNode* single = singleCommand(tree);
+    if (single != NULL && findDefinition(state, single->words[0], DEFINITION_ALIAS) == NULL) {
+        execInputInChild(state, expandCommand(state, single));
+    }
+    exit(runNode(state, tree));
+}
+
+
+/*
+* Run an expanded simple command in the current (child) process and exit
+* with it's exit value, exec'ing it in place when it is an external one.
+* Never returns.
+*/
+void execInputInChild(struct shellState* state, struct input* subInput) {
+
+    int result;
+    struct shellDefinition* function = findDefinition(state, subInput->args[0], DEFINITION_FUNCTION);
+    if (function != NULL) {
+        result = callFunction(state, function, subInput);
+    } else {
+        if (builtinHash(subInput->args[0]) == -1) {
+            subInput->resolvedPath = resolveCommand(state, subInput->args[0]);
+            execParsedInput(state, subInput);
+        }
+        result = runInput(state, subInput);
+    }
+    freeUserInput(subInput);
+    exit(result);
+}
+
+
+/*
+* Create a shell state. Initialize all values of each structure to avoid
+* "Conditional jump or move depends on unitialised value(s)" errors.
+*/
+struct shellState* smallshCreate(void) {
+
+    struct shellState* state = malloc(sizeof(struct shellState));
+    state->outFD = STDOUT_FILENO;
+    state->bgIgnore = 0;
+    state->exitRequested = 0;
+    state->exitCode = 0;
+    state->foregroundOnly = 0;
+    state->capturing = 0;
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        state->pathCache[i] = NULL;
+    }
+    for (int i = 0; i < VARIABLE_BUCKETS; i++) {
+        state->variables[i] = NULL;
+    }
+    state->envp = NULL;
+    state->envpValid = 0;
+    state->lastCode = 0;
+    state->shellPid = getpid();
+    state->defaultTimeoutMs = 0;
+    state->defaultKillAfterMs = 5000;
+    state->spreadJobs = 0;
+    state->spreadNext = 0;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        state->defaultLimits[i] = LIMIT_UNSET;
+    }
+    for (int i = 0; i < USER_FD_AMOUNT; i++) {
+        state->userFDs[i] = -1;
+    }
+    state->loopDepth = 0;
+    state->loopControl = 0;
+    state->interrupted = 0;
+    state->tailCommand = NULL;
+    outputInit(&state->output, STDOUT_FILENO);
+    state->statsEnabled = 1;
+    state->statsFile[0] = '\0';
+    memset(state->metrics, 0, sizeof(state->metrics));
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        state->commandStats[i] = NULL;
+    }
+    state->spawnStarted = 0;
+    for (int i = 0; i < DEFINITION_BUCKETS; i++) {
+        state->definitions[i] = NULL;
+    }
+    state->positional = NULL;
+    state->positionalAmount = 0;
+    state->functionDepth = 0;
+    for (int i = 0; i < LINE_ARRAY_BUCKETS; i++) {
+        state->lineArrays[i] = NULL;
+    }
+    for (int i = 0; i < PROMPT_CACHE; i++) {
+        memset(&state->promptCache[i], 0, sizeof(struct promptSegment));
+        state->promptCache[i].fd = -1;
+    }
+    state->promptCount = 0;
+    state->promptLines = 1;
+
+    // Initialize a linked list to keep track of backgorund processes.
+    state->bgList = malloc(sizeof(struct bgProcess));
+    state->bgList->pid = -1;
+    state->bgList->runStatus = 0;
+    state->bgList->procSub = 0;
+    state->bgList->started = 0;
+    state->bgList->stats = NULL;
+    for (int i = 0; i < LIMIT_AMOUNT; i++) {
+        state->bgList->limits[i] = LIMIT_UNSET;
+    }
+    state->bgList->pidFD = -1;
+    state->bgList->reaped = 0;
+    state->bgList->head = state->bgList;
+    state->bgList->tail = state->bgList;
+    state->bgList->next = NULL;
+
+    // Initialize the lastStatus to keep track of forground exit statuses.
+    state->lastStatus = malloc(sizeof(struct statusStr));
+    char* message = "exit value 0";
+    state->lastStatus->exitStatus = malloc((strlen(message) + 1) * sizeof(char));
+    strcpy(state->lastStatus->exitStatus, message);
+    state->lastStatus->exitValue = 0;
+    state->lastStatus->termSignal = 0;
+    state->lastStatus->timedOut = 0;
+
+    // Initialize savedPWD to keep track of currPWD and prevPWD.
+    state->savedPWD = malloc(sizeof(struct directories));
+    strcpy(state->savedPWD->currPWD, "");
+    strcpy(state->savedPWD->prevPWD, "");
+
+    // Take over the environment as exported variables.
+    importEnvironment(state);
+    return state;
+}
+
+
+/*
+* Parse, expand and run one command line, optionally capturing it's output.
+*/
+int smallshRun(struct shellState* state, const char* command, struct smallshResult* result) {
+
+    // Drop the line feed a line read from a file or terminal ends with.
+    size_t commandLen = strlen(command);
+    if (commandLen > 0 && command[commandLen-1] == '\n') {
+        commandLen--;
+    }
+
+    /* Captured commands write into an anonymous memory file: builtins through
+    state->outFD, children through their stdout, so nothing can block on a 
+    full pipe while the command is still running. */
+    int memFD = -1;
+    int savedOutFD = state->outFD;
+    if (result != NULL) {
+        memFD = memfd_create("smallsh-result", MFD_CLOEXEC);
+        if (memFD == -1) {
+            return -1;
+        }
+        state->outFD = memFD;
+    }
+
+    /* Parse and run the command, captured commands always in the foreground.
+    A syntax error fails like bash does, with exit value 2. */
+    char* line = calloc(commandLen + 1, sizeof(char));
+    strncpy(line, command, commandLen);
+    struct commandNode* tree;
+    int exitValue = 2;
+    state->interrupted = 0;
+    int64_t parseStarted = smallshClock(state);
+    int parsed = parseCommandLine(line, &tree);
+    recordMetric(state, METRIC_PARSE, NULL, parseStarted);
+    if (parsed == 0) {
+        state->foregroundOnly = (result != NULL);
+        state->capturing = (result != NULL);
+        exitValue = runNode(state, tree);
+        state->foregroundOnly = 0;
+        state->capturing = 0;
+        freeCommandNode(tree);
+    }
+    if (state->exitRequested) {
+        exitValue = state->exitCode;
+    }
+    state->lastCode = exitValue;
+    outputFlush(&state->output);
+    free(line);
+
+    // Hand back the status and anything written to the memory file.
+    if (result != NULL) {
+        state->outFD = savedOutFD;
+        struct captureBuffer capture = { NULL, 0, 0 };
+        lseek(memFD, 0, SEEK_SET);
+        readAllFD(memFD, &capture);
+        close(memFD);
+        result->output = capture.data;
+        result->outputLength = capture.length;
+        result->exitValue = exitValue;
+        result->termSignal = (exitValue > 128 && state->exitRequested == 0) ? state->lastStatus->termSignal : 0;
+    }
+    return 0;
+}
+
+
+/*
+* Run one command line, exec'ing it's last command in place when nothing is
+* left to do after it.
+*/
+int smallshExec(struct shellState* state, const char* command) {
+
+    char* line = malloc((strlen(command) + 1) * sizeof(char));
+    strcpy(line, command);
+    struct commandNode* tree;
+    int exitValue = 2;
+    state->interrupted = 0;
+    int64_t parseStarted = smallshClock(state);
+    int parsed = parseCommandLine(line, &tree);
+    recordMetric(state, METRIC_PARSE, NULL, parseStarted);
+    if (parsed == 0) {
+        state->tailCommand = tailCommand(tree);
+        exitValue = runNode(state, tree);
+        state->tailCommand = NULL;
+        freeCommandNode(tree);
+    }
+
+    // "exit N" decides the value even when more of the line would follow.
+    if (state->exitRequested) {
+        exitValue = state->exitCode;
+    }
+    state->lastCode = exitValue;
+    outputFlush(&state->output);
+    free(line);
+    return exitValue;
+}
+
+
+/*
+* Free the captured output of a result.
+*/
+void smallshFreeResult(struct smallshResult* result) {
+
+    free(result->output);
+    result->output = NULL;
+    result->outputLength = 0;
+    return;
+}
+
+
+/*
+* Kinds of file descriptors watched by the epoll set of a server.
+*/
+#define SERVER_LISTENER 0
+#define SERVER_CLIENT 1
+#define SERVER_CHILD 2
+
+
+/*
+* Something the server waits on: the listening socket, a connected client,
+* or the pidfd of a child running a client's request.
+*/
+struct serverWatch {
+    int type;
+    int fd;
+
+    // For children: the pid, the client waiting for the reply and it's id.
+    pid_t pid;
+    int clientFD;
+    uint32_t requestId;
+
+    struct serverWatch* next;
+};
+
+
+/*
+* Send a reply for a finished request, if it's client is still connected.
+*/
+void serverReply(int clientFD, uint32_t requestId, int childStatus, struct rusage* usage) {
+
+    if (clientFD == -1) {
+        return;
+    }
+    struct smallshReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.requestId = requestId;
+    if (WIFEXITED(childStatus)) {
+        reply.exitValue = WEXITSTATUS(childStatus);
+    } else {
+        reply.termSignal = WTERMSIG(childStatus);
+        reply.exitValue = 128 + reply.termSignal;
+    }
+    if (usage != NULL) {
+        reply.usage = *usage;
+    }
+    send(clientFD, &reply, sizeof(reply), MSG_NOSIGNAL);
+    return;
+}
+
+
+/*
+* Start the command of one request. It is parsed in the server under the
+* request's cwd, so the PATH cache and expansions stay in this process, then
+* run by a child with the client's fds, cwd and environment through the same
+* execParsedInput()/ioRedirection() path as any other command. Returns the
+* child's pid, or -1 after replying with an error.
+*/
+pid_t serverStart(struct shellState* state, int clientFD, struct smallshRequestHeader* header, char* command, char* cwd, char* env, int* clientFDs) {
+
+    // Parse the command as if the shell was standing in the client's cwd.
+    int homeFD = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (chdir(cwd) == -1) {
+        char message[PATH_MAX + 40];
+        snprintf(message, sizeof(message), "cd: %s: No such file or directory\n", cwd);
+        write(clientFDs[2], message, strlen(message));
+        serverReply(clientFD, header->requestId, 1 << 8, NULL);
+        close(homeFD);
+        return -1;
+    }
+    struct commandNode* tree;
+    if (parseCommandLine(command, &tree) == -1) {
+        fchdir(homeFD);
+        close(homeFD);
+        serverReply(clientFD, header->requestId, 2 << 8, NULL);
+        return -1;
+    }
+
+    // Warm the PATH cache in the server so children share the lookup.
+    struct commandNode* single = singleCommand(tree);
+    if (single != NULL && single->wordAmount > 0 && builtinHash(single->words[0]) == -1 &&
+        strchr(single->words[0], '$') == NULL) {
+        resolveCommand(state, single->words[0]);
+    }
+    fchdir(homeFD);
+    close(homeFD);
+
+    pid_t spawnPid = fork();
+    switch (spawnPid) {
+        case -1:
+            perror("server: fork()");
+            serverReply(clientFD, header->requestId, 1 << 8, NULL);
+            break;
+        case 0:
+            ;
+
+            // Behave as a foreground child: "^C" ends it, "^Z" is ignored.
+            struct sigaction childAction = {0};
+            childAction.sa_handler = SIG_DFL;
+            sigaction(SIGINT, &childAction, NULL);
+            childAction.sa_handler = SIG_IGN;
+            sigaction(SIGTSTP, &childAction, NULL);
+
+            // Take over the client's stdin, stdout and stderr, cwd and environment.
+            for (int i = 0; i < 3; i++) {
+                dup2(clientFDs[i], i);
+            }
+            chdir(cwd);
+            for (char* entry = env; entry < env + header->envLength; entry += strlen(entry) + 1) {
+                char* equals = strchr(entry, '=');
+                if (equals != NULL) {
+                    *equals = '\0';
+                    setVariable(state, entry, equals + 1);
+                    exportVariable(state, entry);
+                }
+            }
+
+            // Blank and comment lines succeed without running anything.
+            if (tree == NULL) {
+                exit(0);
+            }
+            state->outFD = STDOUT_FILENO;
+            state->foregroundOnly = 1;
+            execNodeInChild(state, tree);
+        default:
+            break;
+    }
+    freeCommandNode(tree);
+    return spawnPid;
+}
+
+
+/*
+* Receive one request from a client and start it, watching the child's pidfd.
+* Returns -1 once the client has hung up.
+*/
+int serverReceive(struct shellState* state, int epollFD, struct serverWatch* client, struct serverWatch** watches) {
+
+    // One SOCK_SEQPACKET message is one request, fds arrive with it.
+    char* message = malloc(SERVER_MAX_REQUEST);
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec vector = { message, SERVER_MAX_REQUEST };
+    struct msghdr header = {0};
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t length = recvmsg(client->fd, &header, MSG_CMSG_CLOEXEC);
+    if (length <= 0) {
+        free(message);
+        return (length == -1 && errno == EINTR) ? 0 : -1;
+    }
+
+    // Collect the client's stdin, stdout and stderr.
+    int clientFDs[3] = { -1, -1, -1 };
+    int fdAmount = 0;
+    for (struct cmsghdr* part = CMSG_FIRSTHDR(&header); part != NULL; part = CMSG_NXTHDR(&header, part)) {
+        if (part->cmsg_level == SOL_SOCKET && part->cmsg_type == SCM_RIGHTS) {
+            int partAmount = (part->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < partAmount; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(part) + i * sizeof(int), sizeof(int));
+                if (fdAmount < 3) {
+                    clientFDs[fdAmount++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    /* Check the request is complete: three fds, and strings that fill the
+    message exactly and are each NUL terminated. */
+    struct smallshRequestHeader* request = (struct smallshRequestHeader*) message;
+    int valid = (fdAmount == 3 && (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0 && length >= (ssize_t) sizeof(*request));
+    char* command = message + sizeof(*request);
+    char* cwd = NULL;
+    char* env = NULL;
+    if (valid) {
+        size_t total = sizeof(*request) + (size_t) request->commandLength + request->cwdLength + request->envLength;
+        cwd = command + request->commandLength;
+        env = cwd + request->cwdLength;
+        valid = (total == (size_t) length && request->commandLength > 0 && request->cwdLength > 0 &&
+                 command[request->commandLength-1] == '\0' && cwd[request->cwdLength-1] == '\0' &&
+                 (request->envLength == 0 || env[request->envLength-1] == '\0'));
+    }
+
+    pid_t spawnPid = -1;
+    if (valid) {
+        spawnPid = serverStart(state, client->fd, request, command, cwd, env, clientFDs);
+    } else {
+        struct smallshReply reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.requestId = (length >= (ssize_t) sizeof(uint32_t)) ? request->requestId : 0;
+        reply.exitValue = -1;
+        send(client->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+    for (int i = 0; i < fdAmount; i++) {
+        close(clientFDs[i]);
+    }
+
+    // Watch the child through a pidfd, or wait right away without one.
+    if (spawnPid > 0) {
+        int pidFD = syscall(SYS_pidfd_open, spawnPid, 0);
+        if (pidFD == -1) {
+            int childStatus;
+            struct rusage usage;
+            wait4(spawnPid, &childStatus, 0, &usage);
+            serverReply(client->fd, request->requestId, childStatus, &usage);
+        } else {
+            struct serverWatch* child = calloc(1, sizeof(struct serverWatch));
+            child->type = SERVER_CHILD;
+            child->fd = pidFD;
+            child->pid = spawnPid;
+            child->clientFD = client->fd;
+            child->requestId = request->requestId;
+            child->next = *watches;
+            *watches = child;
+            struct epoll_event event = { EPOLLIN, { .ptr = child } };
+            epoll_ctl(epollFD, EPOLL_CTL_ADD, pidFD, &event);
+        }
+    }
+    free(message);
+    return 0;
+}
+
+
+/*
+* Stop watching and free a watch, unlinking it from the list of watches.
+*/
+void serverForget(int epollFD, struct serverWatch* watch, struct serverWatch** watches) {
+
+    epoll_ctl(epollFD, EPOLL_CTL_DEL, watch->fd, NULL);
+    close(watch->fd);
+    for (struct serverWatch** link = watches; *link != NULL; link = &(*link)->next) {
+        if (*link == watch) {
+            *link = watch->next;
+            break;
+        }
+    }
+    free(watch);
+    return;
+}
+
+
+/*
+* Serve command requests on a Unix domain socket. A single epoll set watches
+* the listening socket, every client, and a pidfd per running request, so
+* many clients are multiplexed by one long lived process that keeps it's 
+* PATH cache and environment warm.
+*/
+int smallshServe(struct shellState* state, const char* socketPath) {
+
+    // Create the listening socket, replacing a stale one left at the path.
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    int listenFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenFD == -1) {
+        return -1;
+    }
+    /* Requests run as the server's user, so the socket is created for that
+    user alone (0600) and clients are checked again when they connect. */
+    unlink(socketPath);
+    mode_t savedMask = umask(0077);
+    int bound = bind(listenFD, (struct sockaddr*) &address, sizeof(address));
+    umask(savedMask);
+    if (bound == -1 || chmod(socketPath, 0600) == -1 || listen(listenFD, 128) == -1) {
+        close(listenFD);
+        return -1;
+    }
+
+    int epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFD == -1) {
+        close(listenFD);
+        return -1;
+    }
+    struct serverWatch listener = { SERVER_LISTENER, listenFD, 0, -1, 0, NULL };
+    struct epoll_event event = { EPOLLIN, { .ptr = &listener } };
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, listenFD, &event);
+    struct serverWatch* watches = NULL;
+
+    struct epoll_event events[64];
+    while (1) {
+        int ready = epoll_wait(epollFD, events, 64, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            struct serverWatch* watch = events[i].data.ptr;
+
+            if (watch->type == SERVER_LISTENER) {
+
+                // A new client connected, watch it for requests.
+                int clientFD = accept4(listenFD, NULL, NULL, SOCK_CLOEXEC);
+                if (clientFD == -1) {
+                    continue;
+                }
+
+                // Only the server's own user (or root) may run commands.
+                struct ucred peer;
+                socklen_t peerLen = sizeof(peer);
+                if (getsockopt(clientFD, SOL_SOCKET, SO_PEERCRED, &peer, &peerLen) == -1 
+                    || (peer.uid != geteuid() && peer.uid != 0)) {
+                    close(clientFD);
+                    continue;
+                }
+                struct serverWatch* client = calloc(1, sizeof(struct serverWatch));
+                client->type = SERVER_CLIENT;
+                client->fd = clientFD;
+                client->next = watches;
+                watches = client;
+                struct epoll_event clientEvent = { EPOLLIN, { .ptr = client } };
+                epoll_ctl(epollFD, EPOLL_CTL_ADD, clientFD, &clientEvent);
+
+            } else if (watch->type == SERVER_CLIENT) {
+
+                /* The client hung up. Requests still running finish unreported,
+                clear their client so the fd number can be reused. */
+                if (serverReceive(state, epollFD, watch, &watches) == -1) {
+                    for (struct serverWatch* other = watches; other != NULL; other = other->next) {
+                        if (other->type == SERVER_CHILD && other->clientFD == watch->fd) {
+                            other->clientFD = -1;
+                        }
+                    }
+                    serverForget(epollFD, watch, &watches);
+                }
+
+            } else {
+
+                // A request's child ended, reap it with it's resource usage and reply.
+                int childStatus;
+                struct rusage usage;
+                if (wait4(watch->pid, &childStatus, 0, &usage) == watch->pid) {
+                    serverReply(watch->clientFD, watch->requestId, childStatus, &usage);
+                }
+                serverForget(epollFD, watch, &watches);
+            }
+        }
+    }
+
+    // Only an epoll failure ends the server.
+    int errnum = errno;
+    while (watches != NULL) {
+        serverForget(epollFD, watches, &watches);
+    }
+    close(epollFD);
+    close(listenFD);
+    errno = errnum;
+    return -1;
+}
+
+
+/*
+* Send one request to a smallsh server and wait for it's reply.
+*/
+int smallshRequest(const char* socketPath, const char* command, char* const env[], struct smallshReply* reply) {
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    // Build the message: header, command, cwd and environment overrides.
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+    struct smallshRequestHeader request;
+    request.requestId = 1;
+    request.commandLength = strlen(command) + 1;
+    request.cwdLength = strlen(cwd) + 1;
+    request.envLength = 0;
+    for (int i = 0; env != NULL && env[i] != NULL; i++) {
+        request.envLength += strlen(env[i]) + 1;
+    }
+    size_t length = sizeof(request) + request.commandLength + request.cwdLength + request.envLength;
+    if (length > SERVER_MAX_REQUEST) {
+        errno = E2BIG;
+        return -1;
+    }
+    char* message = malloc(length);
+    memcpy(message, &request, sizeof(request));
+    char* cursor = message + sizeof(request);
+    memcpy(cursor, command, request.commandLength);
+    cursor += request.commandLength;
+    memcpy(cursor, cwd, request.cwdLength);
+    cursor += request.cwdLength;
+    for (int i = 0; env != NULL && env[i] != NULL; i++) {
+        memcpy(cursor, env[i], strlen(env[i]) + 1);
+        cursor += strlen(env[i]) + 1;
+    }
+
+    // Attach stdin, stdout and stderr to the message.
+    int stdFDs[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(stdFDs))];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = { message, length };
+    struct msghdr header = {0};
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    struct cmsghdr* part = CMSG_FIRSTHDR(&header);
+    part->cmsg_level = SOL_SOCKET;
+    part->cmsg_type = SCM_RIGHTS;
+    part->cmsg_len = CMSG_LEN(sizeof(stdFDs));
+    memcpy(CMSG_DATA(part), stdFDs, sizeof(stdFDs));
+
+    // Send the request and wait for the reply.
+    int result = -1;
+    int socketFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socketFD != -1 && connect(socketFD, (struct sockaddr*) &address, sizeof(address)) == 0 &&
+        sendmsg(socketFD, &header, MSG_NOSIGNAL) == (ssize_t) length) {
+        ssize_t received;
+        do {
+            received = recv(socketFD, reply, sizeof(*reply), 0);
+        } while (received == -1 && errno == EINTR);
+        if (received == sizeof(*reply)) {
+            result = 0;
+        } else if (received >= 0) {
+            errno = EPROTO;
+        }
+    }
+    int errnum = errno;
+    if (socketFD != -1) {
+        close(socketFD);
+    }
+    free(message);
+    errno = errnum;
+    return result;
+}
@@ -0,0 +1,557 @@
+/*
+* libsmallsh: the parser, expansions, redirection and process handling of
+* smallsh as a library. Every function works on the shellState it is given
+* and the library keeps no globals, so a program can run commands without
+* starting /bin/sh and hold several independent shell states.
+*/
+#ifndef LIBSMALLSH_H
+#define LIBSMALLSH_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+#include <signal.h> // sig_atomic_t
+#include <linux/limits.h> // PATH_MAX
+#include <sys/resource.h> // struct rusage
+#include <sys/uio.h> // struct iovec
+
+// Buckets of the table caching where PATH lookups found each command.
+#define PATH_CACHE_BUCKETS 256
+#define VARIABLE_BUCKETS 256
+#define USER_FD_AMOUNT 10
+
+/* Resource limits set with ulimit, indexes of a limits array. Values are in 
+KiB for LIMIT_ADDRESS and LIMIT_FILESIZE, seconds for LIMIT_CPU and counts 
+otherwise, LIMIT_UNSET when not set and LIMIT_UNLIMITED for "unlimited". */
+#define LIMIT_ADDRESS 0
+#define LIMIT_CPU 1
+#define LIMIT_FILES 2
+#define LIMIT_PROCESSES 3
+#define LIMIT_FILESIZE 4
+#define LIMIT_AMOUNT 5
+#define LIMIT_UNSET -1
+#define LIMIT_UNLIMITED -2
+
+// Largest request message a smallsh server accepts.
+#define SERVER_MAX_REQUEST 65536
+
+
+/*
+* Struct to hold the characteristics of user input.
+*/
+struct input {
+
+    // Input variables
+    char* buffer;
+    char* expandedBuffer;
+
+    /* NULL terminated argument vector, grown as arguments are added since
+    glob and command substitution can produce any number of them */
+    char** args;
+    int argCapacity;
+
+    /* Pathmax because the arg could be a absolute path 
+    to a file, and PATH_MAX is the maximum length of a path
+    in linux */
+    char newStdout[PATH_MAX];
+    char newStdin[PATH_MAX];
+
+    int argAmount;
+    int bgFlag;    
+
+    /* Parent side of every "<(cmd)" / ">(cmd)" pipe, closed once the 
+    command that was handed the matching /dev/fd/N path has been started */
+    int procSubFds[64];
+    int procSubAmount;
+
+    // Full path of args[0] found through the PATH cache, NULL to use execvp.
+    char* resolvedPath;
+
+    /* Deadline of a foreground child in milliseconds, -1 to use the shell's
+    default, and the grace between SIGTERM and SIGKILL once it has passed */
+    long timeoutMs;
+    long killAfterMs;
+
+    // CPUs, NUMA nodes and priorities to launch the child with, NULL for none.
+    struct placement* placement;
+
+    // Resource limits of the child, overriding the shell's defaults.
+    long limits[LIMIT_AMOUNT];
+
+    /* "NAME=value" words put in front of the command, "NAME" alone for a 
+    variable removed by "env -u", and whether "env -i" emptied the rest of
+    the environment the command gets */
+    char** assignments;
+    int assignmentAmount;
+    int clearEnvironment;
+
+    // Set for the last command of a smallshExec() line, exec'd in place.
+    int tailExec;
+
+    /* Child copying a builtin's output to each of several ">" targets, 0
+    for none, waited for once the builtin closed it's end of the pipe */
+    pid_t fanPumpPid;
+};
+
+
+/*
+* Struct to keep track of current and previous directories.
+*/
+struct directories {
+
+    /* Pathmax because the arg could be a absolute path
+    to a file, and PATH_MAX is the maximum length of a path
+    in linux */
+    char currPWD[PATH_MAX];
+    char prevPWD[PATH_MAX];
+};
+
+
+/*
+* Linked list to keeep track of run status of all processes running 
+* in the background.
+*/
+struct bgProcess {
+    int pid;
+    int runStatus;
+
+    // When it was forked and the stats of it's command, for the metrics.
+    int64_t started;
+    struct commandStats* stats;
+
+    /* Set for the feeder children of process substitution so they
+    are reaped quietly instead of reported as background jobs */
+    int procSub;
+
+    // Resource limits the job was started with, to explain how it ended.
+    long limits[LIMIT_AMOUNT];
+
+    /* pidfd of the job (-1 for none), watched while the shell waits at the
+    prompt so the job is reaped as it ends. A job reaped before it was 
+    reported keeps it's wait status and CPU time until then. */
+    int pidFD;
+    int reaped;
+    int waitStatus;
+    int64_t cpuUsed;
+    struct bgProcess* head;
+    struct bgProcess* tail;
+    struct bgProcess* next;
+};
+
+
+/*
+* Struct to keep track of previous foreground exit status.
+*/
+struct statusStr {
+
+    // Int exitStatus;
+    char* exitStatus;
+
+    /* The same status as numbers: the exit value, or 128 + the signal
+    number with termSignal set when the process was killed by a signal */
+    int exitValue;
+    int termSignal;
+
+    // Deadline in milliseconds the process was killed for, 0 if it was not.
+    long timedOut;
+};
+
+
+/*
+* Entry of the PATH cache: a command name and the executable it resolved to.
+*/
+struct pathEntry {
+    char* name;
+    char* path;
+    struct pathEntry* next;
+};
+
+
+/*
+* Shell variable, set by "for" loops, "NAME=value" and export and read by 
+* $NAME. pair holds "NAME=value" as it goes into the environment of children
+* when the variable is exported, value points into it.
+*/
+struct shellVariable {
+    char* name;
+    char* value;
+    char* pair;
+    int exported;
+    struct shellVariable* next;
+};
+
+
+/*
+* Messages for the terminal, batched and written with a single writev(). 
+* Text is copied into data and constants are referenced where they are, 
+* neither needs malloc() or stdio, so signal handlers can format into a
+* buffer of their own.
+*/
+#define OUTPUT_BUFFER_SIZE 4096
+#define OUTPUT_SEGMENTS 64
+struct outputBuffer {
+    int fd;
+    char data[OUTPUT_BUFFER_SIZE];
+    size_t length;
+    struct iovec segments[OUTPUT_SEGMENTS];
+    int segmentAmount;
+};
+
+
+/*
+* Latency metrics. The first METRIC_PER_COMMAND are also kept per command
+* name: fork() to the return in the parent, fork() to the exit being 
+* reaped, and how long a finished background job waited to be reaped. The
+* last two are only recorded for background jobs seen ending through their
+* pidfd, as the shell does while it waits at the prompt. Parse
+* time and time blocked reading input are kept for the whole shell.
+*/
+#define METRIC_SPAWN 0
+#define METRIC_RUN 1
+#define METRIC_REAP 2
+#define METRIC_PER_COMMAND 3
+#define METRIC_PARSE 3
+#define METRIC_INPUT 4
+#define METRIC_AMOUNT 5
+#define STATS_BUCKETS 64
+
+
+/*
+* Histogram of nanosecond latencies in the style of HdrHistogram: one group
+* of buckets per power of two, split into 2^HISTOGRAM_SUB_BITS linear ones,
+* so every value is kept to within 12.5% in a fixed 4KiB.
+*/
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+
+/*
+* Metrics of one command name, chained by hash().
+*/
+struct commandStats {
+    char* name;
+    struct histogram metrics[METRIC_PER_COMMAND];
+    struct commandStats* next;
+};
+
+
+/*
+* An alias or a shell function, chained by hash() in the shell's table. 
+* body is the command tree parsed when it was defined: the simple command
+* an alias stands for, or the compound command of a function. It keeps the
+* literal flags of it's words, so a call only expands words holding "$1",
+* "$NAME" or globs and never parses again.
+*/
+#define DEFINITION_BUCKETS 64
+#define DEFINITION_ALIAS 0
+#define DEFINITION_FUNCTION 1
+struct shellDefinition {
+    char* name;
+    int type;
+    struct commandNode* body;
+
+    /* Calls of a function in progress, and whether it was redefined or
+    removed meanwhile, so the last call to return frees it. */
+    int running;
+    int removed;
+    struct shellDefinition* next;
+};
+
+
+/*
+* Lines read by mapfile, chained by hash() in the shell's table. They are
+* not copied out: data is the file mapped with mmap(), or everything read
+* from a pipe in one buffer, and line i runs from offset starts[i] up to
+* the newline before starts[i+1]. running counts the for loops walking it,
+* so one replaced meanwhile is freed by the last of them.
+*/
+#define LINE_ARRAY_BUCKETS 16
+struct lineArray {
+    char* name;
+    char* data;
+    size_t length;
+    int mapped;
+    size_t* starts;
+    size_t lineAmount;
+    int running;
+    int removed;
+    struct lineArray* next;
+};
+
+
+/*
+* Cached output of a "\(cmd)" segment of PS1 in one directory. It is
+* recomputed by a child in the background each time a prompt shows it, the
+* prompt meanwhile drawing the last value. pid and fd are the child and
+* the read end of it's pipe while one runs, 0 and -1 otherwise.
+*/
+#define PROMPT_CACHE 32
+#define PROMPT_SEGMENT_MAX 256
+#define PROMPT_SEGMENT_TIMEOUT_MS 10000
+struct promptSegment {
+    char* command;
+    char cwd[PATH_MAX];
+    char* value;
+    int pid;
+    int fd;
+    char pending[PROMPT_SEGMENT_MAX];
+    size_t pendingLength;
+    int64_t started;
+    uint64_t lastUsed;
+};
+
+
+/*
+* Everything one shell keeps between commands.
+*/
+struct shellState {
+    struct bgProcess* bgList;
+    struct statusStr* lastStatus;
+    struct directories* savedPWD;
+
+    // Where builtins and shell messages write, STDOUT_FILENO unless captured.
+    int outFD;
+
+    /* Set while "&" is ignored. Written from the SIGTSTP handler of the 
+    smallsh program, so it must be a sig_atomic_t. */
+    volatile sig_atomic_t bgIgnore;
+
+    /* Set by the "exit" builtin for the program driving the state, with the
+    value it should exit with: N of "exit N", else the last exit value */
+    int exitRequested;
+    int exitCode;
+
+    // Set while "&" must be ignored regardless of bgIgnore, as for captured runs.
+    int foregroundOnly;
+
+    /* Set while output is captured for a caller, so the shell's own notes 
+    about children killed by a signal stay out of it. */
+    int capturing;
+
+    /* Deadline for every foreground command in milliseconds, 0 for none, and 
+    the grace between SIGTERM and SIGKILL once one has passed. */
+    long defaultTimeoutMs;
+    long defaultKillAfterMs;
+
+    /* Set while background jobs are spread over the shell's CPUs one after 
+    the other, spreadNext counting the jobs launched so far. */
+    int spreadJobs;
+    int spreadNext;
+
+    // Resource limits of every child, set with ulimit.
+    long defaultLimits[LIMIT_AMOUNT];
+
+    /* Descriptors 3-9 opened with "exec N>file", -1 when closed. The files 
+    are held at close-on-exec descriptors of 10 and up, children only get 
+    the ones their redirections name ("cmd >&3"). */
+    int userFDs[USER_FD_AMOUNT];
+
+    // Command names already looked up in PATH, chained by hash().
+    struct pathEntry* pathCache[PATH_CACHE_BUCKETS];
+
+    /* Shell variables chained by hash(), imported from the environment when
+    the state is created, and the value of $?. */
+    struct shellVariable* variables[VARIABLE_BUCKETS];
+    int lastCode;
+
+    /* The value of $$: the pid of the process that created the state, so
+    children expanding words for it (substitutions) give the same one. */
+    int shellPid;
+
+    /* NULL terminated pairs of the exported variables handed to exec, only
+    rebuilt after an exported variable changed (envpValid cleared). */
+    char** envp;
+    int envpValid;
+
+    /* Loops being run, and the "break" or "continue" waiting to be taken
+    by the innermost of them. */
+    int loopDepth;
+    int loopControl;
+
+    /* Set when "^C" should stop the commands being run. Written from the 
+    SIGINT handler of the smallsh program, so it must be a sig_atomic_t. */
+    volatile sig_atomic_t interrupted;
+
+    /* The command of the line smallshExec() is running that nothing runs
+    after, NULL otherwise. */
+    struct commandNode* tailCommand;
+
+    /* Shell messages waiting for the terminal, such as background jobs 
+    that are done. Written before the next command runs, or together with
+    the prompt. */
+    struct outputBuffer output;
+
+    /* Latency metrics, recorded while statsEnabled is set, and the file a
+    snapshot of them is written to when the state is destroyed (empty for
+    none). spawnStarted is when the last child was forked. */
+    int statsEnabled;
+    char statsFile[PATH_MAX];
+    struct histogram metrics[METRIC_AMOUNT];
+    struct commandStats* commandStats[STATS_BUCKETS];
+    int64_t spawnStarted;
+
+    /* Aliases and functions, and the arguments of the function being run
+    ("$1", "$#", "$@") with how deeply calls are nested. */
+    struct shellDefinition* definitions[DEFINITION_BUCKETS];
+    char** positional;
+    int positionalAmount;
+    int functionDepth;
+
+    // Arrays of lines loaded by mapfile.
+    struct lineArray* lineArrays[LINE_ARRAY_BUCKETS];
+
+    /* "\(cmd)" segments of PS1 by command and directory, how many prompts
+    were drawn (to find the least recently used), and how many lines the 
+    last prompt took, to redraw it in place. */
+    struct promptSegment promptCache[PROMPT_CACHE];
+    uint64_t promptCount;
+    int promptLines;
+};
+
+
+/*
+* Structured result of smallshRun(). output holds everything the command
+* wrote to stdout and is NUL terminated, free it with smallshFreeResult().
+*/
+struct smallshResult {
+    int exitValue;
+    int termSignal;
+    char* output;
+    size_t outputLength;
+};
+
+
+/*
+* Fixed part of a request sent to a smallsh server over it's SOCK_SEQPACKET
+* socket. It is followed in the same message by commandLength bytes of
+* command line, cwdLength bytes of working directory and envLength bytes of
+* "NAME=value" strings, each NUL terminated. The client's stdin, stdout and
+* stderr travel with the message as SCM_RIGHTS.
+*/
+struct smallshRequestHeader {
+    uint32_t requestId;
+    uint32_t commandLength;
+    uint32_t cwdLength;
+    uint32_t envLength;
+};
+
+
+/*
+* Reply a smallsh server sends once the command of a request has ended.
+*/
+struct smallshReply {
+    uint32_t requestId;
+    int exitValue;
+    int termSignal;
+    struct rusage usage;
+};
+
+
+/*
+* Create a shell state starting in the current directory with a status
+* of "exit value 0".
+*/
+struct shellState* smallshCreate(void);
+
+/*
+* Parse, expand and run one command line. If result is not NULL the command
+* runs in the foreground with it's stdout captured into result. Returns 0, or
+* -1 if output could not be captured.
+*/
+int smallshRun(struct shellState* state, const char* command, struct smallshResult* result);
+
+/*
+* Run one command line for "smallsh -c". The last command of the line is
+* exec'd in place of the calling process when the shell has nothing left
+* to do after it, so this only returns if it did not. Returns the exit 
+* value of the line.
+*/
+int smallshExec(struct shellState* state, const char* command);
+
+/*
+* Free the captured output of a result.
+*/
+void smallshFreeResult(struct smallshResult* result);
+
+/*
+* Reap finished background commands, reporting each of them in state->output.
+*/
+void checkBgProcesses(struct shellState* state);
+
+/*
+* Add the prompt to state->output: PS1 with it's segments filled in, or
+* ": " when PS1 is not set. "\(cmd)" segments show their cached output and
+* start computing a fresh one in the background.
+*/
+void smallshPrompt(struct shellState* state);
+
+/*
+* Wait until inputFD is readable, redrawing the prompt in place on the 
+* terminal each time a "\(cmd)" segment of it finishes with new output.
+*/
+void smallshPromptWait(struct shellState* state, int inputFD);
+
+/*
+* Start timing something for the metrics: the current CLOCK_MONOTONIC time
+* in nanoseconds, 0 when metrics are off.
+*/
+int64_t smallshClock(struct shellState* state);
+
+/*
+* Record the time since started, from smallshClock(), for metric (one of
+* METRIC_*). Does nothing for a started of 0.
+*/
+void smallshRecord(struct shellState* state, int metric, int64_t started);
+
+/*
+* Start an empty output buffer writing to fd.
+*/
+void outputInit(struct outputBuffer* output, int fd);
+
+/*
+* Add a copy of text to output. Async-signal-safe.
+*/
+void outputText(struct outputBuffer* output, const char* text);
+
+/*
+* Add text to output without copying it, for strings that outlive the next
+* outputFlush() such as literals. Async-signal-safe.
+*/
+void outputConstant(struct outputBuffer* output, const char* text);
+
+/*
+* Add number in decimal to output. Async-signal-safe.
+*/
+void outputNumber(struct outputBuffer* output, long number);
+
+/*
+* Write everything in output with one writev() and empty it. 
+* Async-signal-safe.
+*/
+void outputFlush(struct outputBuffer* output);
+
+/*
+* Serve command requests on a Unix domain socket at socketPath until an
+* error occurs. Returns -1 with errno set.
+*/
+int smallshServe(struct shellState* state, const char* socketPath);
+
+/*
+* Send command to the smallsh server at socketPath, to run in the current
+* directory with this process's stdin, stdout and stderr plus the given
+* NULL terminated "NAME=value" overrides (or NULL). Waits for the reply.
+* Returns 0, or -1 with errno set.
+*/
+int smallshRequest(const char* socketPath, const char* command, char* const env[], struct smallshReply* reply);
+
+/*
+* Kill and reap remaining background commands and free the state.
+*/
+void smallshDestroy(struct shellState* state);
+
+#endif